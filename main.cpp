@@ -1,16 +1,287 @@
-#include <iostream>
 
-// TIP To <b>Run</b> code, press <shortcut actionId="Run"/> or click the <icon src="AllIcons.Actions.Execute"/> icon in the gutter.
-int main() {
-    // TIP Press <shortcut actionId="RenameElement"/> when your caret is at the <b>lang</b> variable name to see how CLion can help you rename it.
-    auto lang = "C++";
-    std::cout << "Hello and welcome to " << lang << "!\n";
+// Author Philip Kail
 
-    for (int i = 1; i <= 5; i++) {
-        // TIP Press <shortcut actionId="Debug"/> to start debugging your code. We have set one <icon src="AllIcons.Debugger.Db_set_breakpoint"/> breakpoint for you, but you can always add more by pressing <shortcut actionId="ToggleLineBreakpoint"/>.
-        std::cout << "i = " << i << std::endl;
+//===-- main.cpp - ssa2dot batch tool -------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Renders the graphs of many .ll/.bc files in one process, without going
+// through opt and building a pass pipeline for every file. The output is the
+// same as that of the SSAtoDot and SSAtoDotModule passes.
+//
+// With -ssa2dot-bundle the graphs of a module go into one indexed
+// <source>.dotbundle, or .jsonlbundle or .ssagraphbundle with another
+// -ssa2dot-format, -extract prints single graphs back out of bundles.
+//
+// -passes runs a pass pipeline on every module before it is rendered, with
+// -ssa2dot-print-changed the graphs of the functions it changes are written
+// pass by pass.
+//
+// Bitcode is loaded lazily: only the bodies of the functions selected with
+// -ssa2dot-filter are read, so picking a few functions out of a large LTO
+// module costs about as much as the functions themselves.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <optional>
+
+using namespace llvm;
+
+static cl::list<std::string> inputFiles(cl::Positional, cl::OneOrMore,
+    cl::desc("<input .ll/.bc files, or bundles with -extract>"));
+
+static cl::opt<bool> moduleGraph("module-graph",
+    cl::desc("Write one <source>.dot file per module instead of one file per function"),
+    cl::init(false));
+
+static cl::opt<unsigned> threads("j",
+    cl::desc("Number of threads rendering the functions of a module, 0 uses all cores (default 1)"),
+    cl::init(1));
+
+static cl::opt<std::string> extractFunction("extract",
+    cl::desc("Print the graph of this function from each input bundle instead of rendering"),
+    cl::value_desc("function"));
+
+static cl::opt<std::string> passPipeline("passes",
+    cl::desc("Run this pass pipeline on every module before rendering it, e.g. -passes='default<O3>'"),
+    cl::value_desc("pipeline"));
+
+static cl::opt<bool> timeTrace("time-trace",
+    cl::desc("Record a Chrome trace of the rendering stages, per function"),
+    cl::init(false));
+
+static cl::opt<std::string> timeTraceFile("time-trace-file",
+    cl::desc("File the -time-trace profile is written to"),
+    cl::init("ssa2dot.time.json"));
+
+static cl::opt<unsigned> timeTraceGranularity("time-trace-granularity",
+    cl::desc("Minimum duration in microseconds of the events recorded by -time-trace"),
+    cl::init(500));
+
+Error materializeSelectedFunctions(Module &M);
+Error extractGraph(StringRef bundleFile, StringRef functionName);
+Error runPassPipeline(Module &M);
+ssa2dot::ModuleHeat computeHeat(Module &M);
+
+
+// Reads the bodies of the functions that pass -ssa2dot-filter. The others
+// stay unmaterialized and are skipped by the writers.
+Error materializeSelectedFunctions(Module &M)
+{
+  for (Function &F : M)
+  {
+    if (F.isMaterializable() && ssa2dot::isFunctionSelected(F))
+    {
+      if (Error materializeError = F.materialize())
+      {
+        return materializeError;
+      }
+    }
+  }
+
+  return Error::success();
+}
+
+
+// Prints the graph of a function from a bundle to stdout.
+Error extractGraph(StringRef bundleFile, StringRef functionName)
+{
+  Expected<std::unique_ptr<ssa2dot::GraphBundle>> bundle = ssa2dot::GraphBundle::open(bundleFile);
+  if (!bundle)
+  {
+    return bundle.takeError();
+  }
+
+  Expected<StringRef> graph = (*bundle)->lookup(functionName);
+  if (!graph)
+  {
+    return graph.takeError();
+  }
+
+  // Binary graphs are written as they are, and not onto a terminal. Text
+  // graphs end with a line break.
+  if ((*bundle)->graphExtension() == ".ssagraph")
+  {
+    if (outs().is_displayed())
+    {
+      return createStringError(inconvertibleErrorCode(), "%s holds binary graphs, redirect the output to a file", bundleFile.str().c_str());
+    }
+    outs() << *graph;
+    return Error::success();
+  }
+
+  outs() << *graph;
+  if (!graph->endswith("\n"))
+  {
+    outs() << "\n";
+  }
+  return Error::success();
+}
+
+
+// Runs -passes on M. With -ssa2dot-print-changed the graphs of the changed
+// functions are written as the pipeline goes.
+Error runPassPipeline(Module &M)
+{
+  PassInstrumentationCallbacks instrumentationCallbacks;
+  SSAtoDotChangedPrinter changedPrinter;
+  changedPrinter.registerCallbacks(instrumentationCallbacks);
+
+  PassBuilder passBuilder(nullptr, PipelineTuningOptions(), {}, &instrumentationCallbacks);
+
+  LoopAnalysisManager loopAnalyses;
+  FunctionAnalysisManager functionAnalyses;
+  CGSCCAnalysisManager sccAnalyses;
+  ModuleAnalysisManager moduleAnalyses;
+
+  passBuilder.registerModuleAnalyses(moduleAnalyses);
+  passBuilder.registerCGSCCAnalyses(sccAnalyses);
+  passBuilder.registerFunctionAnalyses(functionAnalyses);
+  passBuilder.registerLoopAnalyses(loopAnalyses);
+  passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, sccAnalyses, moduleAnalyses);
+
+  ModulePassManager passManager;
+  if (Error parseError = passBuilder.parsePassPipeline(passManager, passPipeline))
+  {
+    return parseError;
+  }
+
+  passManager.run(M, moduleAnalyses);
+  return Error::success();
+}
+
+
+// Heat of the selected functions of M for -ssa2dot-heat, from the analyses a
+// pass manager would provide.
+ssa2dot::ModuleHeat computeHeat(Module &M)
+{
+  PassBuilder passBuilder;
+
+  LoopAnalysisManager loopAnalyses;
+  FunctionAnalysisManager functionAnalyses;
+  CGSCCAnalysisManager sccAnalyses;
+  ModuleAnalysisManager moduleAnalyses;
+
+  passBuilder.registerModuleAnalyses(moduleAnalyses);
+  passBuilder.registerCGSCCAnalyses(sccAnalyses);
+  passBuilder.registerFunctionAnalyses(functionAnalyses);
+  passBuilder.registerLoopAnalyses(loopAnalyses);
+  passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, sccAnalyses, moduleAnalyses);
+
+  return ssa2dot::computeModuleHeat(M, functionAnalyses);
+}
+
+
+int main(int argc, char **argv)
+{
+  InitLLVM initLLVM(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Renders the SSA form of LLVM IR files as DOT graphs\n");
+
+  if (timeTrace)
+  {
+    timeTraceProfilerInitialize(timeTraceGranularity, argv[0]);
+  }
+
+  int exitCode = 0;
+
+  if (!extractFunction.empty())
+  {
+    for (const std::string &inputFile : inputFiles)
+    {
+      if (Error extractError = extractGraph(inputFile, extractFunction))
+      {
+        logAllUnhandledErrors(std::move(extractError), errs(), "");
+        exitCode = 1;
+      }
+    }
+
+    return exitCode;
+  }
+
+  for (const std::string &inputFile : inputFiles)
+  {
+    TimeTraceScope fileScope("ssa2dot file", inputFile);
+
+    // A context per file releases each module's memory once it is rendered.
+    LLVMContext context;
+    SMDiagnostic error;
+
+    // Metadata is loaded lazily too, the debug info of unselected functions
+    // is never read.
+    std::unique_ptr<Module> M = getLazyIRFileModule(inputFile, error, context, true);
+    if (!M)
+    {
+      error.print(argv[0], errs());
+      exitCode = 1;
+      continue;
+    }
+
+    // Passes need the whole module.
+    Error materializeError = passPipeline.empty() ? materializeSelectedFunctions(*M) : M->materializeAll();
+    if (materializeError)
+    {
+      logAllUnhandledErrors(std::move(materializeError), errs(), inputFile + ": ");
+      exitCode = 1;
+      continue;
+    }
+
+    if (!passPipeline.empty())
+    {
+      if (Error pipelineError = runPassPipeline(*M))
+      {
+        logAllUnhandledErrors(std::move(pipelineError), errs(), inputFile + ": ");
+        exitCode = 1;
+        continue;
+      }
+    }
+
+    std::optional<ssa2dot::ModuleHeat> heat;
+    if (ssa2dot::isHeatEnabled())
+    {
+      heat = computeHeat(*M);
+    }
+    const ssa2dot::ModuleHeat *moduleHeat = heat ? &*heat : nullptr;
+
+    if (moduleGraph)
+    {
+      ssa2dot::writeModuleGraph(*M, threads, moduleHeat);
+    }
+    else if (ssa2dot::isBundleOutputEnabled())
+    {
+      ssa2dot::writeGraphBundle(*M, threads, moduleHeat);
+    }
+    else
+    {
+      ssa2dot::writeFunctionGraphs(*M, threads, moduleHeat);
+    }
+  }
+
+  if (timeTrace)
+  {
+    if (Error traceError = timeTraceProfilerWrite(timeTraceFile, ""))
+    {
+      logAllUnhandledErrors(std::move(traceError), errs(), "Could not write the time trace: ");
+      exitCode = 1;
     }
+    timeTraceProfilerCleanup();
+  }
 
-    return 0;
-    // TIP See CLion help at <a href="https://www.jetbrains.com/help/clion/">jetbrains.com/help/clion/</a>. Also, you can try interactive lessons for CLion by selecting 'Help | Learn IDE Features' from the main menu.
-}
\ No newline at end of file
+  return exitCode;
+}
@@ -10,31 +10,248 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "filesystem"
 #include "vector"
-#include <map>
 
 #include <iostream>
-#include <fstream>
+#include <optional>
+#include <thread>
 
 using namespace llvm;
+using ssa2dot::ClusterKind;
+using ssa2dot::EdgeKind;
+using ssa2dot::GraphEmitter;
+using ssa2dot::GraphMetadata;
+using ssa2dot::GraphNode;
+using ssa2dot::NodeKind;
+
+#define DEBUG_TYPE "ssa2dot"
+
+STATISTIC(NumFunctionsRendered, "Number of functions rendered");
+STATISTIC(NumNodes, "Number of nodes written");
+STATISTIC(NumEdges, "Number of edges written");
+STATISTIC(NumBytesWritten, "Number of bytes written to .dot files");
+
+#if LLVM_VERSION_MAJOR >= 19
+using GraphThreadPool = DefaultThreadPool;
+#else
+using GraphThreadPool = ThreadPool;
+#endif
+
+static cl::opt<unsigned> renderThreads("ssa2dot-threads",
+    cl::desc("Number of threads used to render the functions of a module, 0 uses all cores (default 1)"),
+    cl::init(1));
+
+enum class GraphGranularity { Instruction, Block };
+
+static cl::opt<GraphGranularity> graphGranularity("ssa2dot-granularity",
+    cl::desc("What a node of the graph stands for"),
+    cl::values(clEnumValN(GraphGranularity::Instruction, "instruction", "One node per instruction, clustered by basic block (default)"),
+               clEnumValN(GraphGranularity::Block, "block", "One record node per basic block with an instruction per row")),
+    cl::init(GraphGranularity::Instruction));
+
+static cl::opt<bool> defUseEdges("ssa2dot-def-use",
+    cl::desc("Add edges from every instruction and argument to the instructions using it"),
+    cl::init(false));
+
+static cl::opt<unsigned> defUseFanOut("ssa2dot-def-use-fan-out",
+    cl::desc("Values with more users get a single edge to a summary node instead, 0 never collapses (default 8)"),
+    cl::init(8));
+
+static cl::opt<bool> sourceCluster("ssa2dot-source",
+    cl::desc("Add a cluster of the source lines and link every node to its line"),
+    cl::init(false));
+
+bool hasDebugInfo(const Function &F);
+void renderBasicBlockNodes(const Function &F, const GraphMetadata &metaData, ModuleSlotTracker &slotTracker, GraphEmitter &emitter);
+void renderBasicBlockEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter);
+void renderDefUseEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter);
+unsigned int sourceLine(const Instruction &inst, const DIFile *sourceFile);
+std::string outputBaseName(std::string sourceName);
+std::string functionFileName(const Function &F);
+void writeFunctionFile(const Function &F, const std::string &fileName, ssa2dot::AsyncGraphWriter *graphWriter, const ssa2dot::FunctionHeat *heat,
+                       const ssa2dot::GraphPage *page, const MD5::MD5Result &contentHash, ssa2dot::SourceIndexCache *sourceIndexes);
+const ssa2dot::FunctionHeat *functionHeat(const ssa2dot::ModuleHeat *heat, const Function *F);
+bool writeOutputFile(const std::string &fileName, function_ref<void(raw_ostream &outputFile)> writeContents);
+void renderInOrder(size_t count, unsigned int threads, function_ref<void(size_t index, raw_ostream &stream)> renderItem,
+                   function_ref<void(size_t index, function_ref<void(raw_ostream &stream)> writeItem)> consumeItem);
+
+
+
+// Node of an instruction, by the number of its block and its position in it.
+GraphNode instructionNode(unsigned int basicBlockNumber, unsigned int instructionNumber)
+{
+  return {NodeKind::Instruction, basicBlockNumber, instructionNumber};
+}
+
+// True if the block is cold and collapsed into a single node, see
+// -ssa2dot-cold-threshold.
+bool isCollapsed(const GraphMetadata &metaData, const BasicBlock *BB)
+{
+  return metaData.heat && metaData.heat->coldBlocks.contains(BB);
+}
+
+// Node of a basic block in block granularity, or of a collapsed block.
+GraphNode blockNode(const GraphMetadata &metaData, const BasicBlock *BB)
+{
+  return {NodeKind::Block, metaData.basicBlockToNumber.lookup(BB)};
+}
+
+// Node of the first instruction of a block, where the edges into the block end.
+GraphNode blockEntryNode(const GraphMetadata &metaData, const BasicBlock *BB)
+{
+  if (isCollapsed(metaData, BB))
+  {
+    return blockNode(metaData, BB);
+  }
+  return instructionNode(metaData.basicBlockToNumber.lookup(BB), 0);
+}
+
+// True if the block is on the page being rendered, or if F is rendered whole.
+bool isOnPage(const GraphMetadata &metaData, const BasicBlock *BB)
+{
+  return metaData.page == nullptr || metaData.page->contains(metaData.basicBlockToNumber.lookup(BB));
+}
+
+bool isFirstPage(const GraphMetadata &metaData)
+{
+  return metaData.page == nullptr || metaData.page->number == 0;
+}
+
+// Where an edge to the block ends: node, or on a page without the block a
+// stub naming the block and its page, emitted with the first edge to it.
+GraphNode pageStubNode(const GraphMetadata &metaData, const BasicBlock *BB, GraphNode node, GraphEmitter &emitter, DenseSet<unsigned int> &emittedStubs)
+{
+  unsigned int basicBlockNumber = metaData.basicBlockToNumber.lookup(BB);
+  if (metaData.page == nullptr || metaData.page->contains(basicBlockNumber))
+  {
+    return node;
+  }
+
+  unsigned int pageNumber = metaData.page->pageOf(basicBlockNumber);
+  GraphNode stub = {NodeKind::PageStub, basicBlockNumber, pageNumber};
+
+  if (emittedStubs.insert(basicBlockNumber).second)
+  {
+    emitter.node(stub, [BB, basicBlockNumber, pageNumber](raw_ostream &labelStream)
+    {
+      labelStream << "page " << pageNumber + 1 << ": ";
+      if (BB->hasName())
+      {
+        labelStream << BB->getName();
+      }
+      else
+      {
+        labelStream << "block " << basicBlockNumber;
+      }
+    });
+    NumNodes++;
+  }
+
+  return stub;
+}
+
+// Hands the heat of a block, or of the edge to its successor with the given
+// index, to the emitter, if the graph has heat.
+void emitBlockHeat(const GraphMetadata &metaData, const BasicBlock *BB, GraphEmitter &emitter)
+{
+  if (metaData.heat)
+  {
+    emitter.heat(metaData.heat->blockHeat.lookup(BB));
+  }
+}
+
+void emitEdgeHeat(const GraphMetadata &metaData, const BasicBlock *BB, unsigned int successorIndex, GraphEmitter &emitter)
+{
+  if (metaData.heat)
+  {
+    emitter.heat(metaData.heat->edgeHeat.lookup({BB, successorIndex}));
+  }
+}
+
+// Label of a collapsed block.
+void writeColdLabel(const BasicBlock &BB, raw_ostream &labelStream)
+{
+  size_t instructionCount = BB.size();
+  labelStream << instructionCount << (instructionCount == 1 ? " cold instruction" : " cold instructions");
+}
+
+// Node of a source line in the C cluster.
+GraphNode lineNode(unsigned int lineNumber)
+{
+  return {NodeKind::SourceLine, lineNumber};
+}
+
+
+
+// Times a stage of the rendering, for -time-passes in the "ssa2dot" timer
+// group and for -time-trace with the function or file as detail. Region
+// timers cannot run on several threads at once, so they only time stages on
+// the main thread; the time trace covers the render threads as well.
+class StageRegion
+{
+public:
+  StageRegion(StringRef stageName, StringRef detail)
+    : timer(stageName, stageName, "ssa2dot", "SSA to DOT rendering", TimePassesIsEnabled && std::this_thread::get_id() == mainThread),
+      trace(("ssa2dot " + stageName).str(), detail)
+  {
+  }
+
+private:
+  static const std::thread::id mainThread;
+
+  NamedRegionTimer timer;
+  TimeTraceScope trace;
+};
 
-void writeGraph(std::string sourceName, std::string functionName, const std::vector<std::string>& clusterVector);
-void readSourceCode(std::string sourceName);
-struct GraphMetadata mapInstructionToNodeIdentifier(Function &F);
+const std::thread::id StageRegion::mainThread = std::this_thread::get_id();
 
 
 
-struct GraphMetadata
+// Render threads have no time trace profiler of their own. A task started
+// while tracing gets one for its duration, which is then merged into the
+// trace of the process.
+class RenderTaskTrace
 {
-  std::map<BasicBlock*, int> basicBlockToNumber;
-  std::map<Instruction*, std::string> instructionToNodeIdentifier;
-  std::map<BasicBlock*, Instruction*> basicBlockToFirstInstruction;
+public:
+  explicit RenderTaskTrace(bool tracing) : tracing(tracing && !timeTraceProfilerEnabled())
+  {
+    if (this->tracing)
+    {
+      timeTraceProfilerInitialize(0, "ssa2dot");
+    }
+  }
+
+  ~RenderTaskTrace()
+  {
+    if (tracing)
+    {
+      timeTraceProfilerFinishThread();
+    }
+  }
+
+private:
+  bool tracing;
 };
 
 
@@ -44,221 +261,519 @@ struct GraphMetadata
 PreservedAnalyses SSAtoDot::run(Function &F,
                                       FunctionAnalysisManager &AM) {
 
-    DISubprogram *functionInfo = F.getSubprogram();
-    if (functionInfo == nullptr)
+    // The selection ranks the functions of the whole module, so it is made
+    // once per module rather than per function.
+    if (selectionModule != F.getParent()->getModuleIdentifier())
+    {
+      selectedFunctions = ssa2dot::selectFunctionNames(*F.getParent());
+      selectionModule = F.getParent()->getModuleIdentifier();
+
+      renderedFunctions.clear();
+
+      sourceIndexes = std::make_shared<ssa2dot::SourceIndexCache>();
+
+      // Finishes the bundle of the previous module.
+      bundleWriter.reset();
+      if (ssa2dot::isBundleOutputEnabled())
+      {
+        bundleWriter = std::make_shared<ssa2dot::GraphBundleWriter>(outputBaseName(F.getParent()->getSourceFileName()) + ssa2dot::bundleFileExtension());
+      }
+    }
+
+    if (!selectedFunctions.contains(F.getName()))
     {
-      errs() << "LLVM Program has not been compiled with -g flag or this particular function is not debuggable. "
-                "Aborting all procedure. Function in question: " << F.getName()  <<  "\n";
       return PreservedAnalyses::all();
     }
 
-    std::string LLVM_Cluster = "LLVM";
-    std::string C_Cluster = "C";
+    // A duplicate shares the graph of a function rendered before it.
+    const Function *representative = ssa2dot::isDeduplicationEnabled() ? ssa2dot::findRenderedDuplicate(F, renderedFunctions) : nullptr;
+    if (representative)
+    {
+      bool shared = bundleWriter ? ssa2dot::addBundleAliases(*bundleWriter, F, *representative) : ssa2dot::linkFunctionGraph(F, *representative);
+      if (shared)
+      {
+        return PreservedAnalyses::all();
+      }
+    }
 
-    GraphMetadata metaData = mapInstructionToNodeIdentifier(F);
+    std::optional<ssa2dot::FunctionHeat> heat;
+    if (ssa2dot::isHeatEnabled())
+    {
+      heat = ssa2dot::computeFunctionHeat(F, AM);
+    }
+    const ssa2dot::FunctionHeat *functionHeat = heat ? &*heat : nullptr;
 
+    if (bundleWriter)
+    {
+      // A paginated function gets an entry per page.
+      std::vector<unsigned int> pageStarts = ssa2dot::paginateFunction(F);
+      for (unsigned int pageNumber = 0; pageNumber < std::max<size_t>(pageStarts.size(), 1); ++pageNumber)
+      {
+        ssa2dot::GraphPage page = {pageNumber, pageStarts};
+        const ssa2dot::GraphPage *functionPage = pageStarts.empty() ? nullptr : &page;
+        std::string entryName = pageStarts.empty() ? F.getName().str() : ssa2dot::pageFileName(F.getName(), pageNumber);
 
+        ssa2dot::SourceIndexCache *functionSourceIndexes = sourceIndexes.get();
+        bundleWriter->addGraph(entryName, [&F, functionHeat, functionPage, functionSourceIndexes](raw_ostream &bundleStream)
+        {
+          ssa2dot::renderGraph(bundleStream, [&F, functionHeat, functionPage, functionSourceIndexes](raw_ostream &clusterStream)
+          {
+            ssa2dot::renderFunctionCluster(F, "", clusterStream, functionHeat, functionPage, functionSourceIndexes);
+          });
+        });
+      }
+    }
+    else
+    {
+      if (!graphWriter && ssa2dot::writeQueueLimit() != 0)
+      {
+        graphWriter = std::make_shared<ssa2dot::AsyncGraphWriter>(ssa2dot::writeQueueLimit());
+      }
 
+      ssa2dot::writeFunctionGraph(F, graphWriter.get(), functionHeat, sourceIndexes.get());
+    }
 
+    return PreservedAnalyses::all();
+}
 
 
-    StringRef functionName = F.getName();
-    unsigned int lineNum = functionInfo->getLine();
 
+PreservedAnalyses SSAtoDotModule::run(Module &M,
+                                      ModuleAnalysisManager &AM) {
 
-    std::vector<std::string> LLVM_ClusterArray;
+    if (ssa2dot::isHeatEnabled())
+    {
+      FunctionAnalysisManager &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+      ssa2dot::ModuleHeat heat = ssa2dot::computeModuleHeat(M, FAM);
+      ssa2dot::writeModuleGraph(M, renderThreads, &heat);
+    }
+    else
+    {
+      ssa2dot::writeModuleGraph(M, renderThreads);
+    }
 
+    return PreservedAnalyses::all();
+}
 
 
 
-    std::string argumentList;
-    llvm::raw_string_ostream argumentStream(argumentList);
+bool hasDebugInfo(const Function &F)
+{
+  if (F.getSubprogram() == nullptr)
+  {
+    errs() << "LLVM Program has not been compiled with -g flag or this particular function is not debuggable. "
+              "Aborting all procedure. Function in question: " << F.getName()  <<  "\n";
+    return false;
+  }
+
+  return true;
+}
+
 
-    std::vector<const llvm::Argument*> argumentArray;
-    for (const llvm::Argument &arg : F.args())
-    {
-      argumentArray.push_back(&arg);
-    }
 
-    for (const llvm::Argument* arg : argumentArray)
+// Renders the "LLVM" cluster of a single function into the given stream,
+// with the backend of -ssa2dot-format. Every node and cluster name is
+// prefixed with nodePrefix so that several functions can share one digraph
+// without their identifiers colliding. The function must have debug
+// information, see hasDebugInfo.
+//
+// Nodes and edges are handed to the emitter as the IR is walked, nothing but
+// the block numbering is kept in memory. With heat, cold blocks are rendered
+// as a single node and the edges into and out of them end there. With a
+// page, only the blocks of the page are rendered, see ssa2dotPages.cpp.
+void ssa2dot::renderFunctionCluster(const Function &F, StringRef nodePrefix, raw_ostream &llvmMainClusterStream, const FunctionHeat *heat,
+                                    const GraphPage *page, SourceIndexCache *sourceIndexes)
+{
+    StageRegion functionRegion("function", F.getName());
+
+    GraphMetadata metaData = mapInstructionToNodeIdentifier(F, nodePrefix);
+    metaData.heat = heat;
+    metaData.page = page;
+    metaData.sourceIndexes = sourceIndexes;
+
+    std::unique_ptr<GraphEmitter> emitter = createGraphEmitter(llvmMainClusterStream);
+
+    // Positions are laid out per function, functions sharing a digraph would
+    // be placed on top of each other and are left to dot, as are pages.
+    if (isLayoutEnabled() && nodePrefix.empty() && page == nullptr)
     {
-      argumentStream << *arg << "\n";
+      emitter = createLayoutEmitter(F, metaData, std::move(emitter));
     }
+    emitter->beginFunction(F.getName(), nodePrefix);
 
+    // Labeling covers the nodes and the edges that chain them inside blocks.
+    std::optional<StageRegion> labelingRegion;
+    labelingRegion.emplace("labeling", F.getName());
 
+    // One slot tracker numbers the function once for all of its labels,
+    // printing with operator<< would renumber it for every instruction.
+    ModuleSlotTracker slotTracker(F.getParent(), false);
+    slotTracker.incorporateFunction(F);
 
-    std::string llvmClusterStr;
-    llvm::raw_string_ostream llvmMainClusterStream(llvmClusterStr);
-
-    llvmMainClusterStream << "subgraph cluster_" << LLVM_Cluster << "_1" << "{";
-    llvmMainClusterStream << "label = \"" << LLVM_Cluster << "\";";
-    llvmMainClusterStream << "FNAME [label = \"" << functionName << "\"]";
+    NumFunctionsRendered++;
+    unsigned int nodeCount = 1;
+    unsigned int edgeCount = isFirstPage(metaData) ? 1 : 0;
 
 
+    emitter->beginCluster(ClusterKind::Function, 1, "LLVM");
+    emitter->node({NodeKind::FunctionName}, [&F, page](raw_ostream &labelStream)
+    {
+      labelStream << F.getName();
+      if (page)
+      {
+        labelStream << " (page " << page->number + 1 << " of " << page->pageStarts.size() << ")";
+      }
+    });
 
+    GraphNode entryNode = graphGranularity == GraphGranularity::Block ? blockNode(metaData, &F.front()) : blockEntryNode(metaData, &F.front());
 
-    if (!argumentArray.empty())
+    // Later pages start wherever the edges from earlier ones lead.
+    if (isFirstPage(metaData) && !F.arg_empty())
     {
-      llvmMainClusterStream << "ARGUMENTS [label = \"" << argumentStream.str() << "\" , shape=ellipse, color=red]";
-      llvmMainClusterStream << " FNAME -> ARGUMENTS; " << "ARGUMENTS -> " << metaData.instructionToNodeIdentifier[&F.front().front()] << "; ";
+      emitter->node({NodeKind::Arguments}, [&F, &slotTracker](raw_ostream &labelStream)
+      {
+        for (const llvm::Argument &arg : F.args())
+        {
+          arg.print(labelStream, slotTracker);
+          labelStream << "\n";
+        }
+      });
+
+      emitter->edge({NodeKind::FunctionName}, {NodeKind::Arguments}, EdgeKind::Entry);
+      emitter->edge({NodeKind::Arguments}, entryNode, EdgeKind::Entry);
+      nodeCount++;
+      edgeCount++;
     }
-    else
+    else if (isFirstPage(metaData))
     {
-      llvmMainClusterStream << " FNAME -> " << metaData.instructionToNodeIdentifier[&F.front().front()] << "; ";
+      emitter->edge({NodeKind::FunctionName}, entryNode, EdgeKind::Entry);
     }
 
+    if (graphGranularity == GraphGranularity::Block)
+    {
+      renderBasicBlockNodes(F, metaData, slotTracker, *emitter);
+      labelingRegion.reset();
 
-    std::string branchEdges;
-    llvm::raw_string_ostream branchEdgesStream(branchEdges);
+      NumNodes += nodeCount;
+      NumEdges += edgeCount;
 
+      renderBasicBlockEdges(F, metaData, *emitter);
+      if (defUseEdges)
+      {
+        renderDefUseEdges(F, metaData, *emitter);
+      }
+      emitter->endCluster();
+
+      if (sourceCluster)
+      {
+        ssa2dot::renderSourceCluster(F, metaData, *emitter);
+      }
+      emitter->endFunction();
+      return;
+    }
 
 
     // Basic Block Iteration Loop
-    for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b)
+    for (const BasicBlock &basicBlock : F)
     {
-      std::string basicBlockDOTCluster;
-      llvm::raw_string_ostream basicBlockClusterStream(basicBlockDOTCluster);
+      const BasicBlock* BB = &basicBlock;
+      unsigned int basicBlockNumber = metaData.basicBlockToNumber.lookup(BB);
 
+      if (!isOnPage(metaData, BB))
+      {
+        continue;
+      }
 
-      BasicBlock* BB = &*b;
+      emitBlockHeat(metaData, BB, *emitter);
+      emitter->beginCluster(ClusterKind::Block, basicBlockNumber, BB->getName());
 
-      basicBlockClusterStream << "\n subgraph cluster_" << metaData.basicBlockToNumber[BB] << " {"; // Begin Cluster
-      basicBlockClusterStream << "label = \"" << BB->getName() << "\";"; // Label the Cluster with the Basic Block Name
+      if (isCollapsed(metaData, BB))
+      {
+        emitBlockHeat(metaData, BB, *emitter);
+        emitter->node(blockNode(metaData, BB), [BB](raw_ostream &labelStream)
+        {
+          writeColdLabel(*BB, labelStream);
+        }, llvm::isa_and_nonnull<llvm::ReturnInst>(BB->getTerminator()));
+        nodeCount++;
 
+        emitter->endCluster();
+        continue;
+      }
 
 
+      unsigned int instructionNumber = 0;
 
+      // Instruction Iteration Loop
+      for (llvm::BasicBlock::const_iterator i = BB->begin(), ie = BB->end(); i != ie; ++i, ++instructionNumber)
+      {
+        const Instruction* inst = &*i;
 
+        emitter->node(instructionNode(basicBlockNumber, instructionNumber), [inst, &slotTracker](raw_ostream &labelStream)
+        {
+          ssa2dot::printInstructionLabel(*inst, slotTracker, labelStream);
+        }, llvm::isa<llvm::ReturnInst>(inst));
+      }
 
-      std::vector<std::string> toLink;
+      for (unsigned int i = 0; i + 1 < instructionNumber; ++i)
+      {
+        emitter->edge(instructionNode(basicBlockNumber, i), instructionNode(basicBlockNumber, i + 1), EdgeKind::Sequence);
+        edgeCount++;
+      }
+      nodeCount += instructionNumber;
 
 
-      // Instruction Iteration Loop
-      for (llvm::BasicBlock::iterator i = BB->begin(), ie = BB->end(); i != ie; ++i)
-      {
+      emitter->endCluster();
+    }
 
-        Instruction* inst = &*i;
 
+    labelingRegion.reset();
 
-        std::string nodeIdentifier;
-        llvm::raw_string_ostream nodeIdentifierStream(nodeIdentifier);
+    NumNodes += nodeCount;
+    NumEdges += edgeCount;
 
-        nodeIdentifierStream << metaData.instructionToNodeIdentifier[inst];
+    renderBranchEdges(F, metaData, *emitter);
 
+    if (defUseEdges)
+    {
+      renderDefUseEdges(F, metaData, *emitter);
+    }
 
-        std::string clearedString;
-        llvm::raw_string_ostream stringCleaner(clearedString);
+    emitter->endCluster();
 
+    if (sourceCluster)
+    {
+      ssa2dot::renderSourceCluster(F, metaData, *emitter);
+    }
 
-        ReturnInst *returnInst = llvm::dyn_cast<llvm::ReturnInst>(inst);
+    emitter->endFunction();
+}
 
-        std::string retColor = "";
-        if (returnInst)
-        {
-          retColor = "shape=ellipse, color=lightgreen";
-        }
 
-        if (DILocation *diLocation = inst->getDebugLoc())
-        {
 
+bool ssa2dot::isSourceClusterEnabled()
+{
+  return sourceCluster;
+}
 
 
-          unsigned int cLine = diLocation->getLine();
-          inst->setDebugLoc(DebugLoc()); // DI Removal for Label
 
-          stringCleaner << *inst;
-          clearedString = stringCleaner.str();
-          clearedString.erase(std::remove(clearedString.begin(), clearedString.end(), '\"'), clearedString.end());
+// Line of the instruction in the function's own source file, 0 if it has no
+// location there, e.g. code inlined from a header.
+unsigned int sourceLine(const Instruction &inst, const DIFile *sourceFile)
+{
+  const DILocation *location = inst.getDebugLoc();
+  if (location == nullptr || location->getFile() != sourceFile)
+  {
+    return 0;
+  }
 
+  return location->getLine();
+}
 
-          basicBlockClusterStream << nodeIdentifierStream.str() << " ";
-          basicBlockClusterStream << "[label = \"" << clearedString << "\"" << retColor <<"];";
-          inst->setDebugLoc(diLocation); // DI ADD FOR INTEGRITY
 
 
+// Renders the "C" cluster with one node per source line that F refers to,
+// followed by dashed edges from the function name to its declaration line and
+// from every node to the line of its instruction. The lines are read from
+// the SourceLineIndex of F's file shared through the cache of the metadata,
+// without one the file is indexed for this graph alone. Only the line numbers
+// are collected.
+void ssa2dot::renderSourceCluster(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter)
+{
+    StageRegion region("source cluster", F.getName());
+
+    const DISubprogram *functionInfo = F.getSubprogram();
+    const DIFile *sourceFile = functionInfo->getFile();
+
+    SmallString<128> sourceName(functionInfo->getFilename());
+    if (sys::path::is_relative(sourceName))
+    {
+      sourceName = functionInfo->getDirectory();
+      sys::path::append(sourceName, functionInfo->getFilename());
+    }
+
+    std::shared_ptr<const SourceLineIndex> sourceIndex = metaData.sourceIndexes ? metaData.sourceIndexes->get(sourceName) : SourceLineIndex::create(sourceName);
+    if (!sourceIndex)
+    {
+      return;
+    }
+
+    auto isIndexed = [&sourceIndex](unsigned int lineNumber)
+    {
+      return lineNumber != 0 && lineNumber <= sourceIndex->lineCount();
+    };
+
+    // The declaration line belongs to the first page.
+    bool declarationLine = isFirstPage(metaData) && isIndexed(functionInfo->getLine());
+
+    std::vector<unsigned int> lineNumbers;
+    if (declarationLine)
+    {
+      lineNumbers.push_back(functionInfo->getLine());
+    }
+    for (const BasicBlock &BB : F)
+    {
+      if (!isOnPage(metaData, &BB))
+      {
+        continue;
+      }
+
+      for (const Instruction &inst : BB)
+      {
+        unsigned int lineNumber = sourceLine(inst, sourceFile);
+        if (isIndexed(lineNumber))
+        {
+          lineNumbers.push_back(lineNumber);
         }
-        else
+      }
+    }
+    llvm::sort(lineNumbers);
+    lineNumbers.erase(std::unique(lineNumbers.begin(), lineNumbers.end()), lineNumbers.end());
+
+    emitter.beginCluster(ClusterKind::Source, 1, "C");
+    for (unsigned int lineNumber : lineNumbers)
+    {
+      emitter.node(lineNode(lineNumber), [&sourceIndex, lineNumber](raw_ostream &labelStream)
+      {
+        labelStream << lineNumber << ": " << sourceIndex->line(lineNumber);
+      });
+    }
+    emitter.endCluster();
+    NumNodes += lineNumbers.size();
+
+    unsigned int edgeCount = 0;
+
+    if (declarationLine)
+    {
+      emitter.edge({NodeKind::FunctionName}, lineNode(functionInfo->getLine()), EdgeKind::SourceLine);
+      edgeCount++;
+    }
+
+    for (const BasicBlock &BB : F)
+    {
+      unsigned int basicBlockNumber = metaData.basicBlockToNumber.lookup(&BB);
+      if (!isOnPage(metaData, &BB))
+      {
+        continue;
+      }
+
+      if (graphGranularity == GraphGranularity::Block || isCollapsed(metaData, &BB))
+      {
+        // One edge per line the block refers to.
+        std::vector<unsigned int> blockLines;
+        for (const Instruction &inst : BB)
         {
-          stringCleaner << *inst;
-          clearedString = stringCleaner.str();
-          clearedString.erase(std::remove(clearedString.begin(), clearedString.end(), '\"'), clearedString.end());
+          unsigned int lineNumber = sourceLine(inst, sourceFile);
+          if (isIndexed(lineNumber))
+          {
+            blockLines.push_back(lineNumber);
+          }
+        }
+        llvm::sort(blockLines);
+        blockLines.erase(std::unique(blockLines.begin(), blockLines.end()), blockLines.end());
 
+        for (unsigned int lineNumber : blockLines)
+        {
+          emitter.edge(blockNode(metaData, &BB), lineNode(lineNumber), EdgeKind::SourceLine);
+          edgeCount++;
+        }
+        continue;
+      }
 
-          basicBlockClusterStream << nodeIdentifierStream.str() << " ";
-          basicBlockClusterStream << "[label = \"" << clearedString << "\"" << retColor <<"];";
+      unsigned int instructionNumber = 0;
+      for (const Instruction &inst : BB)
+      {
+        unsigned int lineNumber = sourceLine(inst, sourceFile);
+        if (isIndexed(lineNumber))
+        {
+          emitter.edge(instructionNode(basicBlockNumber, instructionNumber), lineNode(lineNumber), EdgeKind::SourceLine);
+          edgeCount++;
         }
+        ++instructionNumber;
+      }
+    }
 
-        if (BranchInst *branchInstruction = llvm::dyn_cast<llvm::BranchInst>(inst))
+    NumEdges += edgeCount;
+}
+
+
+
+// Writes the edges from the terminators to the blocks they branch to. This is
+// a second walk over the function, so that the edges can follow the block
+// clusters without being collected in memory first.
+void ssa2dot::renderBranchEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter)
+{
+    StageRegion region("edges", F.getName());
+
+    unsigned int edgeCount = 0;
+    DenseSet<unsigned int> emittedStubs;
+
+    for (const BasicBlock &basicBlock : F)
+    {
+      unsigned int basicBlockNumber = metaData.basicBlockToNumber.lookup(&basicBlock);
+      unsigned int instructionNumber = 0;
+
+      if (!isOnPage(metaData, &basicBlock))
+      {
+        continue;
+      }
+
+      for (llvm::BasicBlock::const_iterator i = basicBlock.begin(), ie = basicBlock.end(); i != ie; ++i, ++instructionNumber)
+      {
+        const Instruction* inst = &*i;
+
+        GraphNode instructionNode = isCollapsed(metaData, &basicBlock) ? blockNode(metaData, &basicBlock) : ::instructionNode(basicBlockNumber, instructionNumber);
+
+        if (const BranchInst *branchInstruction = llvm::dyn_cast<llvm::BranchInst>(inst))
         {
           int num = branchInstruction->getNumSuccessors();
 
           for (int i = 0; i < num; ++i)
           {
-            if (llvm::BasicBlock* successorBlock = branchInstruction->getSuccessor(i))
+            if (const llvm::BasicBlock* successorBlock = branchInstruction->getSuccessor(i))
             {
-              std::string str;
-              llvm::raw_string_ostream stream(str);
-
-              Instruction* instPrime = &successorBlock->front();
-
-
-              stream << " " << metaData.instructionToNodeIdentifier[inst] << "->" << metaData.instructionToNodeIdentifier[instPrime] << " [color = red]" << "; ";
-
-              branchEdgesStream << stream.str();
+              GraphNode successorNode = pageStubNode(metaData, successorBlock, blockEntryNode(metaData, successorBlock), emitter, emittedStubs);
+              emitEdgeHeat(metaData, &basicBlock, i, emitter);
+              emitter.edge(instructionNode, successorNode, EdgeKind::Branch);
+              edgeCount++;
 
             }
           }
         }
 
-        if (SwitchInst *switchInstruction = llvm::dyn_cast<llvm::SwitchInst>(inst))
+        if (const SwitchInst *switchInstruction = llvm::dyn_cast<llvm::SwitchInst>(inst))
         {
           int num = switchInstruction->getNumSuccessors();
 
           for (int i = 0; i < num; ++i)
           {
-            if (llvm::BasicBlock* successorBlock = switchInstruction->getSuccessor(i))
+            if (const llvm::BasicBlock* successorBlock = switchInstruction->getSuccessor(i))
             {
-              std::string str;
-              llvm::raw_string_ostream stream(str);
-
-              Instruction* instPrime = &successorBlock->front();
-
-              std::string G;
-              if (i == 0)
-              {
-                G = " [label=\"default\", color=red] ";
-              }
-
-              stream << " " << metaData.instructionToNodeIdentifier[inst] << "->" << metaData.instructionToNodeIdentifier[instPrime] << G << "; ";
-
-              branchEdgesStream << stream.str();
+              GraphNode successorNode = pageStubNode(metaData, successorBlock, blockEntryNode(metaData, successorBlock), emitter, emittedStubs);
+              emitEdgeHeat(metaData, &basicBlock, i, emitter);
+              emitter.edge(instructionNode, successorNode, i == 0 ? EdgeKind::SwitchDefault : EdgeKind::SwitchCase);
+              edgeCount++;
 
             }
           }
 
         }
 
-        if (InvokeInst *invokeInst = llvm::dyn_cast<llvm::InvokeInst>(inst))
+        if (const InvokeInst *invokeInst = llvm::dyn_cast<llvm::InvokeInst>(inst))
         {
-          if (llvm::BasicBlock* BB = invokeInst->getNormalDest())
+          if (const llvm::BasicBlock* BB = invokeInst->getNormalDest())
           {
-            std::string str;
-            llvm::raw_string_ostream stream(str);
-            Instruction* instPrime = &BB->front();
-            stream << " " << metaData.instructionToNodeIdentifier[inst] << "->" << metaData.instructionToNodeIdentifier[instPrime] << " [color = blue]" << "; ";
-            branchEdgesStream << stream.str();
-
+            GraphNode successorNode = pageStubNode(metaData, BB, blockEntryNode(metaData, BB), emitter, emittedStubs);
+            emitEdgeHeat(metaData, &basicBlock, 0, emitter);
+            emitter.edge(instructionNode, successorNode, EdgeKind::Invoke);
+            edgeCount++;
           }
-          if (llvm::BasicBlock* BB = invokeInst->getNormalDest())
+          if (const llvm::BasicBlock* BB = invokeInst->getUnwindDest())
           {
-            if (BB != invokeInst -> getNormalDest())
-            {
-              std::string str;
-              llvm::raw_string_ostream stream(str);
-              Instruction* instPrime = &BB->front();
-              stream << " " << metaData.instructionToNodeIdentifier[inst] << "->" << metaData.instructionToNodeIdentifier[instPrime] << " [color = blue]" << "; ";
-              branchEdgesStream << stream.str();
-            }
+            GraphNode successorNode = pageStubNode(metaData, BB, blockEntryNode(metaData, BB), emitter, emittedStubs);
+            emitEdgeHeat(metaData, &basicBlock, 1, emitter);
+            emitter.edge(instructionNode, successorNode, EdgeKind::Invoke);
+            edgeCount++;
           }
 
 
@@ -266,192 +781,778 @@ PreservedAnalyses SSAtoDot::run(Function &F,
         }
 
         /*
-        if (CallInst *branchInstruction = llvm::dyn_cast<llvm::CallInst>(inst))
+        if (const CallInst *branchInstruction = llvm::dyn_cast<llvm::CallInst>(inst))
         {
-          if (Instruction* postCall = branchInstruction->getNextNode())
+          if (const Instruction* postCall = branchInstruction->getNextNode())
           {
-            std::string str;
-            llvm::raw_string_ostream stream(str);
-            stream << " " << metaData.instructionToNodeIdentifier[inst] << "->" << metaData.instructionToNodeIdentifier[postCall] << "; ";
-            branchEdgesStream << stream.str();
+            NodeIdentifier postCallIdentifier = {nodePrefix, basicBlockNumber, instructionNumber + 1};
+            branchEdgesStream << " " << nodeIdentifier << "->" << postCallIdentifier << "; ";
 
           }
         }*/
+      }
+    }
 
+    NumEdges += edgeCount;
+}
 
-        toLink.push_back(nodeIdentifierStream.str());
+
+
+// Block granularity: one record node per basic block, the block name on top
+// and one left-aligned row per instruction below. A collapsed block only has
+// a row with its instruction count.
+void renderBasicBlockNodes(const Function &F, const GraphMetadata &metaData, ModuleSlotTracker &slotTracker, GraphEmitter &emitter)
+{
+    for (const BasicBlock &BB : F)
+    {
+      if (!isOnPage(metaData, &BB))
+      {
+        continue;
       }
 
-      for (size_t i = 0; i < toLink.size(); ++i)
+      bool collapsed = isCollapsed(metaData, &BB);
+
+      emitBlockHeat(metaData, &BB, emitter);
+      emitter.blockNode(blockNode(metaData, &BB), BB.getName(), [&BB, &slotTracker, collapsed](raw_ostream &rowStream)
       {
-        if (i+1 < toLink.size())
+        if (collapsed)
         {
-          basicBlockClusterStream << " " << toLink[i] << "->" << toLink[i+1] << " ";
+          writeColdLabel(BB, rowStream);
+          rowStream << "\n";
+          return;
         }
 
+        for (const Instruction &inst : BB)
+        {
+          ssa2dot::printInstructionLabel(inst, slotTracker, rowStream);
+          rowStream << "\n";
+        }
+      }, llvm::isa_and_nonnull<llvm::ReturnInst>(BB.getTerminator()));
+      NumNodes++;
+    }
+}
+
+
+
+// Block granularity: edges from every block to its successors, styled like
+// the branch edges between instructions.
+void renderBasicBlockEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter)
+{
+    StageRegion region("edges", F.getName());
+
+    DenseSet<unsigned int> emittedStubs;
+
+    for (const BasicBlock &BB : F)
+    {
+      const Instruction *terminator = BB.getTerminator();
+      if (terminator == nullptr || !isOnPage(metaData, &BB))
+      {
+        continue;
       }
 
+      for (unsigned int i = 0, num = terminator->getNumSuccessors(); i < num; ++i)
+      {
+        EdgeKind kind = EdgeKind::Successor;
 
-      basicBlockClusterStream << "} \n"; // Cluster End
+        if (llvm::isa<llvm::BranchInst>(terminator))
+        {
+          kind = EdgeKind::Branch;
+        }
+        else if (llvm::isa<llvm::SwitchInst>(terminator))
+        {
+          kind = i == 0 ? EdgeKind::SwitchDefault : EdgeKind::SwitchCase;
+        }
+        else if (llvm::isa<llvm::InvokeInst>(terminator))
+        {
+          kind = EdgeKind::Invoke;
+        }
 
+        const BasicBlock *successorBlock = terminator->getSuccessor(i);
+        GraphNode successorNode = pageStubNode(metaData, successorBlock, blockNode(metaData, successorBlock), emitter, emittedStubs);
+        emitEdgeHeat(metaData, &BB, i, emitter);
+        emitter.edge(blockNode(metaData, &BB), successorNode, kind);
+      }
 
-      llvmMainClusterStream << basicBlockClusterStream.str();
+      NumEdges += terminator->getNumSuccessors();
+    }
+}
 
 
 
+// Def-use edges, dotted and green, from every argument and instruction to the
+// instructions using it. They do not constrain the layout, which keeps
+// following the control flow. A value with more users than
+// -ssa2dot-def-use-fan-out, e.g. an alloca used all over the function, gets a
+// single edge to a summary node instead, so the edge count stays linear.
+//
+// Arguments start at the ARGUMENTS node. In block granularity the edges run
+// between blocks, one per value and user block, uses inside the defining
+// block are left out. Uses in a collapsed block are treated the same way,
+// values defined in one get no edges. On a page, only values and users on
+// the page are connected, arguments on the first one.
+void renderDefUseEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter)
+{
+    StageRegion region("def-use edges", F.getName());
+
+    unsigned int nodeCount = 0;
+    unsigned int edgeCount = 0;
+    bool blockGranularity = graphGranularity == GraphGranularity::Block;
+
+    // The (block, instruction) numbers of every instruction, and the numbers
+    // of the collapsed blocks.
+    DenseMap<const Instruction*, std::pair<unsigned int, unsigned int>> instructionNodes;
+    DenseSet<unsigned int> collapsedBlocks;
+    for (const BasicBlock &BB : F)
+    {
+      unsigned int basicBlockNumber = metaData.basicBlockToNumber.lookup(&BB);
+      if (!isOnPage(metaData, &BB))
+      {
+        continue;
+      }
+      if (isCollapsed(metaData, &BB))
+      {
+        collapsedBlocks.insert(basicBlockNumber);
+      }
+
+      unsigned int instructionNumber = 0;
+      for (const Instruction &inst : BB)
+      {
+        instructionNodes[&inst] = {basicBlockNumber, instructionNumber++};
+      }
     }
 
+    // Users as (block, instruction) numbers, sorted so that the output does
+    // not depend on the use-list order.
+    std::vector<std::pair<unsigned int, unsigned int>> users;
 
+    // All arguments start at the ARGUMENTS node, a user of several of them
+    // gets a single edge from it.
+    DenseSet<std::pair<unsigned int, unsigned int>> argumentUsers;
 
+    // argument is the argument whose uses these are, null for an instruction.
+    auto renderUses = [&](const Value &value, unsigned int definitionBlock, const GraphNode &definition, const GraphNode &summary, const Argument *argument)
+    {
+      users.clear();
+      for (const User *user : value.users())
+      {
+        const Instruction *userInstruction = dyn_cast<Instruction>(user);
+        auto userNode = instructionNodes.find(userInstruction);
+        if (userNode == instructionNodes.end())
+        {
+          continue;
+        }
 
+        unsigned int userBlock = userNode->second.first;
+        if (!blockGranularity && !collapsedBlocks.contains(userBlock))
+        {
+          users.push_back(userNode->second);
+        }
+        else if (userBlock != definitionBlock)
+        {
+          users.push_back({userBlock, 0});
+        }
+      }
+      llvm::sort(users);
+      users.erase(std::unique(users.begin(), users.end()), users.end());
 
+      if (defUseFanOut != 0 && users.size() > defUseFanOut)
+      {
+        size_t useCount = users.size();
+        emitter.node(summary, [useCount, argument](raw_ostream &labelStream)
+        {
+          labelStream << useCount << " uses";
+          if (argument && argument->hasName())
+          {
+            labelStream << " of %" << argument->getName();
+          }
+          else if (argument)
+          {
+            labelStream << " of argument " << argument->getArgNo();
+          }
+        });
+        emitter.edge(definition, summary, EdgeKind::DefUse);
+        nodeCount++;
+        edgeCount++;
+        return;
+      }
 
+      for (auto [userBlock, userInstruction] : users)
+      {
+        if (argument && !argumentUsers.insert({userBlock, userInstruction}).second)
+        {
+          continue;
+        }
 
-    Module *M = F.getParent();
-    std::string sourceName = M->getSourceFileName();
+        GraphNode user = blockGranularity || collapsedBlocks.contains(userBlock) ? GraphNode{NodeKind::Block, userBlock} : instructionNode(userBlock, userInstruction);
+        emitter.edge(definition, user, EdgeKind::DefUse);
+        edgeCount++;
+      }
+    };
 
+    for (const Argument &arg : F.args())
+    {
+      // Blocks are numbered from 100, so with 0 as the defining block the
+      // uses in the entry block count in block granularity too.
+      if (isFirstPage(metaData))
+      {
+        renderUses(arg, 0, {NodeKind::Arguments}, {NodeKind::ArgumentUseSummary, arg.getArgNo()}, &arg);
+      }
+    }
 
-    llvmMainClusterStream << "\n " << branchEdgesStream.str() << "\n";
+    for (const BasicBlock &BB : F)
+    {
+      if (isCollapsed(metaData, &BB) || !isOnPage(metaData, &BB))
+      {
+        continue;
+      }
 
+      for (const Instruction &inst : BB)
+      {
+        auto [basicBlockNumber, instructionNumber] = instructionNodes.lookup(&inst);
 
+        GraphNode definition = blockGranularity ? GraphNode{NodeKind::Block, basicBlockNumber} : instructionNode(basicBlockNumber, instructionNumber);
+        renderUses(inst, basicBlockNumber, definition, {NodeKind::UseSummary, basicBlockNumber, instructionNumber}, nullptr);
+      }
+    }
 
-    llvmMainClusterStream << "}";
+    NumNodes += nodeCount;
+    NumEdges += edgeCount;
+}
 
 
-    LLVM_ClusterArray.push_back(llvmMainClusterStream.str());
 
+// Writes the options that change how a graph looks, for the graph cache.
+void ssa2dot::printRenderOptions(raw_ostream &optionStream)
+{
+  optionStream << "granularity=" << static_cast<int>(graphGranularity.getValue()) << "\n";
+  optionStream << "source=" << sourceCluster << "\n";
+  optionStream << "defUse=" << defUseEdges << "," << defUseFanOut << "\n";
+  optionStream << "format=" << graphFileExtension() << "\n";
+  optionStream << "layout=" << isLayoutEnabled() << "\n";
+  optionStream << "heat=" << isHeatEnabled() << "\n";
+  optionStream << "pageSize=" << pageSizeLimit() << "\n";
+}
 
-    writeGraph(sourceName, functionName.str(), LLVM_ClusterArray);
 
 
-    return PreservedAnalyses::all();
+// Prints the instruction as operator<< would, but without its !dbg
+// attachment. The attachment is cut from the printed text instead of
+// clearing the debug location, so the IR is never written to.
+void ssa2dot::printInstructionLabel(const Instruction &inst, ModuleSlotTracker &slotTracker, raw_ostream &labelStream)
+{
+  // The buffer is reused by every label printed on the thread, once it has
+  // grown to the longest label printing one does not allocate.
+  static thread_local SmallString<256> label;
+  label.clear();
+
+  raw_svector_ostream instructionStream(label);
+  inst.print(instructionStream, slotTracker);
+
+  // The !dbg attachment is printed first among the attachments, at the end
+  // of the instruction.
+  size_t debugAttachment = inst.getDebugLoc() ? label.rfind(", !dbg !") : StringRef::npos;
+  if (debugAttachment != StringRef::npos)
+  {
+    size_t attachmentEnd = debugAttachment + strlen(", !dbg !");
+    while (attachmentEnd < label.size() && isDigit(label[attachmentEnd]))
+    {
+      attachmentEnd++;
+    }
 
+    labelStream << label.str().take_front(debugAttachment) << label.str().drop_front(attachmentEnd);
+    return;
+  }
+
+  labelStream << label.str();
+}
 
 
 
+std::string outputBaseName(std::string sourceName)
+{
+  return sourceName.erase(sourceName.size()-2);
 }
 
 
 
-void writeGraph(std::string sourceName, std::string functionName, const std::vector<std::string>& clusterVector)
+// Streams a digraph into the given .dot file through a buffered file stream.
+// writeClusters writes the clusters between the graph header and footer.
+// Returns false if the file could not be written.
+bool ssa2dot::writeGraph(const std::string &fileName, function_ref<void(raw_ostream &graphStream)> writeClusters)
 {
+  return writeOutputFile(fileName, [writeClusters](raw_ostream &outputFile)
+  {
+    renderGraph(outputFile, writeClusters);
+  });
+}
+
 
-  sourceName = sourceName.erase(sourceName.size()-2) + "_" + functionName + ".dot";
 
-  std::ofstream outputFile;
-  outputFile.open(sourceName);
+void ssa2dot::renderGraph(raw_ostream &graphStream, function_ref<void(raw_ostream &graphStream)> writeClusters)
+{
+  std::unique_ptr<GraphEmitter> emitter = createGraphEmitter(graphStream);
+
+  emitter->beginGraph();
+  writeClusters(graphStream);
+  emitter->endGraph();
+}
 
-  outputFile.clear();
 
 
-  std::string graphString;
-  llvm::raw_string_ostream stringOstream(graphString);
+// Writes a graph rendered with renderGraph into the given .dot file. Returns
+// false if the file could not be written.
+bool ssa2dot::writeGraphFile(const std::string &fileName, StringRef graph)
+{
+  return writeOutputFile(fileName, [graph](raw_ostream &outputFile)
+  {
+    outputFile << graph;
+  });
+}
 
-  stringOstream << "digraph G {     node [shape=box, style=filled, color=lightblue]; \n" ;
 
 
+// Opens the file, has writeContents write it and closes it, reporting the
+// errors of all three. Returns false if the file could not be written.
+bool writeOutputFile(const std::string &fileName, function_ref<void(raw_ostream &outputFile)> writeContents)
+{
+  StageRegion region("writeGraph", fileName);
 
+  // A symbolic link left by -ssa2dot-dedup is replaced rather than written
+  // through, which would overwrite the graph of another function.
+  if (sys::fs::is_symlink_file(fileName))
+  {
+    sys::fs::remove(fileName);
+  }
 
-  for (size_t i = 0; i < clusterVector.size(); i++)
+  std::error_code errorCode;
+  raw_fd_ostream outputFile(fileName, errorCode, sys::fs::OF_Text);
+  if (errorCode)
   {
-    stringOstream << clusterVector[i];
+    errs() << "Could not open " << fileName << ": " << errorCode.message() << "\n";
+    return false;
   }
 
-  stringOstream << "\n }";
+  writeContents(outputFile);
 
+  NumBytesWritten += outputFile.tell();
+  outputFile.close();
+  if (outputFile.has_error())
+  {
+    errs() << "Could not write " << fileName << ": " << outputFile.error().message() << "\n";
+    outputFile.clear_error();
+    return false;
+  }
 
-  outputFile << stringOstream.str();
+  return true;
+}
 
 
-  outputFile.close();
 
+// Writes the graph of a single function into <source>_<function>.dot, unless
+// the graph cache has it already. The function must have debug information.
+void ssa2dot::writeFunctionGraph(const Function &F, AsyncGraphWriter *graphWriter, const FunctionHeat *heat, SourceIndexCache *sourceIndexes)
+{
+  writeFunctionGraph(F, functionFileName(F), graphWriter, heat, sourceIndexes);
 }
 
 
-void readSourceCode(std::string sourceName)
+
+std::string functionFileName(const Function &F)
 {
-  std::vector<std::string> sourceLines;
+  return outputBaseName(F.getParent()->getSourceFileName()) + "_" + F.getName().str() + ssa2dot::graphFileExtension().str();
+}
 
-  sourceLines.push_back("NULL");
 
-  std::ifstream inputFile;
 
-  inputFile.open(sourceName);
+// A function above -ssa2dot-page-size is written as one file per page, the
+// pages share the content hash of the function.
+void ssa2dot::writeFunctionGraph(const Function &F, const std::string &fileName, AsyncGraphWriter *graphWriter, const FunctionHeat *heat,
+                                 SourceIndexCache *sourceIndexes)
+{
+  MD5::MD5Result contentHash;
+  if (ssa2dot::isGraphCacheEnabled())
+  {
+    contentHash = ssa2dot::hashFunctionContent(F, "", heat, sourceIndexes);
+  }
 
-  std::string individualLine;
-  while (std::getline(inputFile, individualLine))
+  std::vector<unsigned int> pageStarts = paginateFunction(F);
+  if (pageStarts.empty())
   {
-    sourceLines.push_back(individualLine);
+    writeFunctionFile(F, fileName, graphWriter, heat, nullptr, contentHash, sourceIndexes);
+    return;
   }
 
+  for (unsigned int pageNumber = 0; pageNumber < pageStarts.size(); ++pageNumber)
+  {
+    GraphPage page = {pageNumber, pageStarts};
+    writeFunctionFile(F, pageFileName(fileName, pageNumber), graphWriter, heat, &page, contentHash, sourceIndexes);
+  }
+}
+
+
 
+// Writes the graph of F, or of one of its pages, into the file unless the
+// graph cache has it already.
+void writeFunctionFile(const Function &F, const std::string &fileName, ssa2dot::AsyncGraphWriter *graphWriter, const ssa2dot::FunctionHeat *heat,
+                       const ssa2dot::GraphPage *page, const MD5::MD5Result &contentHash, ssa2dot::SourceIndexCache *sourceIndexes)
+{
+  if (ssa2dot::isGraphUpToDate(fileName, contentHash))
+  {
+    return;
+  }
 
+  auto writeClusters = [&F, heat, page, sourceIndexes](raw_ostream &graphStream)
+  {
+    ssa2dot::renderFunctionCluster(F, "", graphStream, heat, page, sourceIndexes);
+  };
 
-  for (std::size_t i = 0; i < sourceLines.size(); i++)
+  if (graphWriter)
   {
+    std::string graph;
+    raw_string_ostream graphStream(graph);
+    ssa2dot::renderGraph(graphStream, writeClusters);
+    graphStream.flush();
 
-    errs() << "L#" << i << ": " << sourceLines[i] << "\n";
+    graphWriter->write(fileName, std::move(graph), contentHash);
+    return;
+  }
 
+  if (ssa2dot::writeGraph(fileName, writeClusters))
+  {
+    ssa2dot::recordGraph(fileName, contentHash);
   }
+}
 
 
 
+// Heat of F out of the heat of its module, null if there is none.
+const ssa2dot::FunctionHeat *functionHeat(const ssa2dot::ModuleHeat *heat, const Function *F)
+{
+  if (heat == nullptr)
+  {
+    return nullptr;
+  }
 
+  auto functionEntry = heat->find(F);
+  return functionEntry != heat->end() ? &functionEntry->second : nullptr;
 }
 
 
 
-struct GraphMetadata mapInstructionToNodeIdentifier(Function &F)
+// Writes every debuggable function of the module into its own .dot file, as
+// the function pass does. With more than one thread the files are written
+// concurrently, each task renders and writes one function, or one page of a
+// paginated function. With one, the files are written in the background, see
+// -ssa2dot-write-queue.
+void ssa2dot::writeFunctionGraphs(const Module &M, unsigned int threads, const ModuleHeat *heat)
 {
-  std::map<BasicBlock*, int> basicBlockToNumber;
-  std::map<Instruction*, std::string> instructionToNodeIdentifier;
-  std::map<BasicBlock*, Instruction*> basicBlockToFirstInstruction;
+  DenseSet<const Function*> selectedFunctions = ssa2dot::selectFunctions(M);
+  std::vector<const Function*> functionsToRender;
+  SourceIndexCache sourceIndexes;
 
+  DenseMap<const Function*, const Function*> duplicateFunctions;
+  if (isDeduplicationEnabled())
+  {
+    duplicateFunctions = findDuplicateFunctions(M, selectedFunctions);
+  }
 
-  int clusterCount = 100;
-  // Basic Block Iteration Loop
-  for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b)
+  for (const Function &F : M.functions())
   {
-    BasicBlock* BB = &*b;
+    // Duplicates are linked to the graph of their representative, and only
+    // rendered if that fails.
+    const Function *representative = duplicateFunctions.lookup(&F);
+    if (selectedFunctions.contains(&F) && !(representative && linkFunctionGraph(F, *representative)))
+    {
+      functionsToRender.push_back(&F);
+    }
+  }
 
+  if (threads == 1)
+  {
+    std::unique_ptr<AsyncGraphWriter> graphWriter;
+    if (writeQueueLimit() != 0)
+    {
+      graphWriter = std::make_unique<AsyncGraphWriter>(writeQueueLimit());
+    }
 
-    int clusterInstruction = 0;
+    for (const Function *F : functionsToRender)
+    {
+      writeFunctionGraph(*F, graphWriter.get(), functionHeat(heat, F), &sourceIndexes);
+    }
 
+    return;
+  }
 
+  GraphThreadPool threadPool(hardware_concurrency(threads));
+  bool tracing = timeTraceProfilerEnabled();
 
-    bool firstInstruction = true;
+  for (const Function *F : functionsToRender)
+  {
+    auto pageStarts = std::make_shared<const std::vector<unsigned int>>(paginateFunction(*F));
+    if (pageStarts->empty())
+    {
+      threadPool.async([F, tracing, heat, &sourceIndexes]()
+      {
+        RenderTaskTrace taskTrace(tracing);
+        writeFunctionGraph(*F, nullptr, functionHeat(heat, F), &sourceIndexes);
+      });
+      continue;
+    }
 
-    // Instruction Iteration Loop
-    for (llvm::BasicBlock::iterator i = BB->begin(), ie = BB->end(); i != ie; ++i)
+    // The function is hashed once for all of its pages.
+    MD5::MD5Result contentHash;
+    if (ssa2dot::isGraphCacheEnabled())
     {
-      Instruction* inst = &*i;
+      contentHash = ssa2dot::hashFunctionContent(*F, "", functionHeat(heat, F), &sourceIndexes);
+    }
+    std::string fileName = functionFileName(*F);
 
-      if (firstInstruction)
+    for (unsigned int pageNumber = 0; pageNumber < pageStarts->size(); ++pageNumber)
+    {
+      threadPool.async([F, tracing, heat, pageStarts, pageNumber, fileName, contentHash, &sourceIndexes]()
       {
-        basicBlockToFirstInstruction[BB] = inst;
+        RenderTaskTrace taskTrace(tracing);
+        GraphPage page = {pageNumber, *pageStarts};
+        writeFunctionFile(*F, pageFileName(fileName, pageNumber), nullptr, functionHeat(heat, F), &page, contentHash, &sourceIndexes);
+      });
+    }
+  }
 
-        firstInstruction = false;
-      }
+  threadPool.wait();
+}
 
-      basicBlockToFirstInstruction[BB] = inst;
 
-      std::string nodeIdentifier;
-      llvm::raw_string_ostream nodeIdentifierStream(nodeIdentifier);
-      nodeIdentifierStream << "Instruction" << clusterCount << "_" << clusterInstruction;
 
+// Writes every debuggable function of the module into one <source>.dot file.
+// Each function becomes its own subgraph, prefixed with its position in the
+// module, and is streamed straight into a single buffered file stream instead
+// of opening one file per function. With more than one thread the functions
+// are rendered ahead on a thread pool, see renderInOrder.
+void ssa2dot::writeModuleGraph(const Module &M, unsigned int threads, const ModuleHeat *heat)
+{
+  std::string fileName = outputBaseName(M.getSourceFileName()) + graphFileExtension().str();
 
-      instructionToNodeIdentifier[inst] = nodeIdentifierStream.str();
+  DenseSet<const Function*> selectedFunctions = ssa2dot::selectFunctions(M);
+  std::vector<std::pair<const Function*, std::string>> functionsToRender;
+  SourceIndexCache sourceIndexes;
 
-      clusterInstruction++;
+  unsigned int functionNumber = 0;
+  for (const Function &F : M.functions())
+  {
+    if (F.isDeclaration())
+    {
+      continue;
     }
 
-    basicBlockToNumber[BB] = clusterCount;
-    clusterCount++; // Increment Cluster Count for uniqueness of Clusters
+    std::string nodePrefix = "F" + std::to_string(functionNumber++) + "_";
+
+    if (selectedFunctions.contains(&F))
+    {
+      functionsToRender.push_back({&F, nodePrefix});
+    }
   }
 
-  struct GraphMetadata metadata = {basicBlockToNumber, instructionToNodeIdentifier, basicBlockToFirstInstruction};
+  // The module graph is cached as a whole, its hash covers every function.
+  MD5::MD5Result contentHash;
+  if (ssa2dot::isGraphCacheEnabled())
+  {
+    MD5 moduleHash;
+    for (auto &[F, nodePrefix] : functionsToRender)
+    {
+      moduleHash.update(ssa2dot::hashFunctionContent(*F, nodePrefix, functionHeat(heat, F), &sourceIndexes).digest());
+    }
+    moduleHash.final(contentHash);
 
+    if (ssa2dot::isGraphUpToDate(fileName, contentHash))
+    {
+      return;
+    }
+  }
 
+  bool written = writeGraph(fileName, [&functionsToRender, threads, heat, &sourceIndexes](raw_ostream &graphStream)
+  {
+    renderInOrder(functionsToRender.size(), threads, [&functionsToRender, heat, &sourceIndexes](size_t i, raw_ostream &clusterStream)
+    {
+      auto &[F, nodePrefix] = functionsToRender[i];
+      renderFunctionCluster(*F, nodePrefix, clusterStream, functionHeat(heat, F), nullptr, &sourceIndexes);
+    },
+    [&graphStream](size_t, function_ref<void(raw_ostream &stream)> writeCluster)
+    {
+      writeCluster(graphStream);
+    });
+  });
+
+  if (written)
+  {
+    ssa2dot::recordGraph(fileName, contentHash);
+  }
+}
+
+
+
+// Writes the graphs of the selected functions into <source>.dotbundle, or the
+// bundle of the -ssa2dot-format, in
+// module order, paginated ones as one entry per page and duplicates as
+// aliases of their representative. The graphs are streamed into the bundle,
+// only the index is kept in memory.
+void ssa2dot::writeGraphBundle(const Module &M, unsigned int threads, const ModuleHeat *heat)
+{
+  DenseSet<const Function*> selectedFunctions = ssa2dot::selectFunctions(M);
+  std::vector<const Function*> functionsToRender;
+
+  for (const Function &F : M.functions())
+  {
+    if (selectedFunctions.contains(&F))
+    {
+      functionsToRender.push_back(&F);
+    }
+  }
+
+  // An entry per function, or per page of a paginated function.
+  struct BundleEntry
+  {
+    const Function *F;
+    std::optional<GraphPage> page;
+  };
+
+  DenseMap<const Function*, const Function*> duplicateFunctions;
+  if (isDeduplicationEnabled())
+  {
+    duplicateFunctions = findDuplicateFunctions(M, selectedFunctions);
+  }
+  llvm::erase_if(functionsToRender, [&duplicateFunctions](const Function *F)
+  {
+    return duplicateFunctions.count(F) != 0;
+  });
+
+  std::vector<std::vector<unsigned int>> functionPages(functionsToRender.size());
+  std::vector<BundleEntry> entries;
+
+  for (size_t i = 0; i < functionsToRender.size(); ++i)
+  {
+    functionPages[i] = paginateFunction(*functionsToRender[i]);
+    if (functionPages[i].empty())
+    {
+      entries.push_back({functionsToRender[i], std::nullopt});
+    }
+    for (unsigned int pageNumber = 0; pageNumber < functionPages[i].size(); ++pageNumber)
+    {
+      entries.push_back({functionsToRender[i], GraphPage{pageNumber, functionPages[i]}});
+    }
+  }
+
+  GraphBundleWriter bundleWriter(outputBaseName(M.getSourceFileName()) + bundleFileExtension());
+  SourceIndexCache sourceIndexes;
+
+  renderInOrder(entries.size(), threads, [&entries, heat, &sourceIndexes](size_t i, raw_ostream &graphStream)
+  {
+    renderGraph(graphStream, [&entry = entries[i], heat, &sourceIndexes](raw_ostream &clusterStream)
+    {
+      renderFunctionCluster(*entry.F, "", clusterStream, functionHeat(heat, entry.F), entry.page ? &*entry.page : nullptr, &sourceIndexes);
+    });
+  },
+  [&entries, &bundleWriter](size_t i, function_ref<void(raw_ostream &stream)> writeGraph)
+  {
+    const BundleEntry &entry = entries[i];
+    bundleWriter.addGraph(entry.page ? pageFileName(entry.F->getName(), entry.page->number) : entry.F->getName().str(), writeGraph);
+  });
+
+  // Module order, so that the bundle does not depend on the map's order.
+  for (const Function &F : M.functions())
+  {
+    if (const Function *representative = duplicateFunctions.lookup(&F))
+    {
+      addBundleAliases(bundleWriter, F, *representative);
+    }
+  }
+}
+
+
+
+// Renders count items and hands each to consumeItem, in order, together with
+// a callback that writes the item into a stream. On one thread the callback
+// renders the item straight into the stream. On more, the items are rendered
+// into separate buffers on a thread pool and the callback copies the buffer,
+// so the output is byte-identical to the serial one. Only a few items per
+// thread are rendered ahead of the one being consumed.
+void renderInOrder(size_t count, unsigned int threads, function_ref<void(size_t index, raw_ostream &stream)> renderItem,
+                   function_ref<void(size_t index, function_ref<void(raw_ostream &stream)> writeItem)> consumeItem)
+{
+  if (threads == 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      consumeItem(i, [renderItem, i](raw_ostream &stream)
+      {
+        renderItem(i, stream);
+      });
+    }
+
+    return;
+  }
+
+  // Rendering only reads the IR, so functions can be rendered concurrently.
+  ThreadPoolStrategy threadStrategy = hardware_concurrency(threads);
+  size_t renderAhead = 4 * threadStrategy.compute_thread_count();
+
+  std::vector<std::string> renderedItems(count);
+  std::vector<std::shared_future<void>> pendingItems;
+
+  GraphThreadPool threadPool(threadStrategy);
+  bool tracing = timeTraceProfilerEnabled();
+
+  auto renderAsync = [&](size_t i)
+  {
+    pendingItems.push_back(threadPool.async([renderItem, &renderedItems, i, tracing]()
+    {
+      RenderTaskTrace taskTrace(tracing);
+      raw_string_ostream itemStream(renderedItems[i]);
+      renderItem(i, itemStream);
+      itemStream.flush();
+    }));
+  };
+
+  for (size_t i = 0; i < count && i < renderAhead; ++i)
+  {
+    renderAsync(i);
+  }
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    pendingItems[i].wait();
+
+    consumeItem(i, [&renderedItems, i](raw_ostream &stream)
+    {
+      stream << renderedItems[i];
+    });
+    std::string().swap(renderedItems[i]);
+
+    if (i + renderAhead < count)
+    {
+      renderAsync(i + renderAhead);
+    }
+  }
+
+  threadPool.wait();
+}
+
+
+
+GraphMetadata ssa2dot::mapInstructionToNodeIdentifier(const Function &F, StringRef nodePrefix)
+{
+  StageRegion region("mapInstructionToNodeIdentifier", F.getName());
+
+  GraphMetadata metadata;
+  metadata.nodePrefix = nodePrefix;
+  metadata.basicBlockToNumber.reserve(F.size());
+
+  unsigned int clusterCount = 100;
+  // Basic Block Iteration Loop
+  for (const BasicBlock &BB : F)
+  {
+    metadata.basicBlockToNumber[&BB] = clusterCount;
+    clusterCount++; // Increment Cluster Count for uniqueness of Clusters
+  }
 
   return metadata;
 }
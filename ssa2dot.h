@@ -1,16 +1,639 @@
-
 #ifndef LLVM_TRANSFORMS_HELLONEW_HELLOWORLD_H
 #define LLVM_TRANSFORMS_HELLONEW_HELLOWORLD_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace llvm {
 
+    class MemoryBuffer;
+    class ModuleSlotTracker;
+
+    namespace ssa2dot {
+        class AsyncGraphWriter;
+        class GraphBundleWriter;
+        class SourceIndexCache;
+        struct FunctionHeat;
+        struct GraphPage;
+        using ModuleHeat = DenseMap<const Function*, FunctionHeat>;
+        using RenderedFunctions = DenseMap<uint64_t, SmallVector<std::string, 1>>;
+    }
+
     class SSAtoDot : public PassInfoMixin<SSAtoDot> {
     public:
         PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+
+    private:
+        // Names of the functions selected for rendering, computed when the
+        // pass sees the first function of a module, see selectFunctionNames.
+        // The module is told apart by its identifier, it may be freed and
+        // another one allocated in its place between two runs.
+        std::string selectionModule;
+        StringSet<> selectedFunctions;
+
+        // Writes the graphs while the next functions are rendered. Shared
+        // by the copies of the pass, the last one to go at pass manager
+        // teardown flushes it.
+        std::shared_ptr<ssa2dot::AsyncGraphWriter> graphWriter;
+
+        // The source files of the current module for -ssa2dot-source,
+        // released when the pass moves on to another module.
+        std::shared_ptr<ssa2dot::SourceIndexCache> sourceIndexes;
+
+        // With -ssa2dot-bundle, the bundle of the current module. Finished
+        // when the pass moves on to another module or is destroyed.
+        std::shared_ptr<ssa2dot::GraphBundleWriter> bundleWriter;
+
+        // With -ssa2dot-dedup, the functions of the module rendered so far,
+        // see findRenderedDuplicate.
+        ssa2dot::RenderedFunctions renderedFunctions;
+    };
+
+    // Module variant of SSAtoDot. Walks the module once and writes every
+    // function as its own subgraph into a single <source>.dot file.
+    class SSAtoDotModule : public PassInfoMixin<SSAtoDotModule> {
+    public:
+        PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+    };
+
+    // Print-changed mode of -ssa2dot-print-changed, an instrumentation
+    // rather than a pass. Before the first pass that runs on a selected
+    // function it writes the function's graph, and after every pass that
+    // changed the function it writes another one, numbered in pipeline
+    // order: <source>_<function>.<number>.<pass>.dot. Changes are detected
+    // with a cheap hash of the IR, see ssa2dotChanged.cpp. Must outlive the
+    // callbacks it registers.
+    class SSAtoDotChangedPrinter {
+    public:
+        void registerCallbacks(PassInstrumentationCallbacks &PIC);
+
+    private:
+        void writeChangedGraphs(Any IR, StringRef passName, bool beforePass);
+
+        // Selection of the module the pipeline runs on, see SSAtoDot.
+        std::string selectionModule;
+        StringSet<> selectedFunctions;
+
+        // Hash of every function, by name, when its last graph was written.
+        StringMap<uint64_t> writtenHashes;
+        unsigned int graphNumber = 0;
+
+        std::shared_ptr<ssa2dot::SourceIndexCache> sourceIndexes;
+
+        std::shared_ptr<ssa2dot::AsyncGraphWriter> graphWriter;
     };
 
+    // Rendering stages of the passes, also used by the ssa2dot tool and the
+    // benchmark.
+    namespace ssa2dot {
+
+        // Writes the graph of F into <source>_<function>.dot, or the
+        // extension of the -ssa2dot-format backend. F must have debug
+        // information. With a writer the graph is rendered into memory
+        // and handed to it, the file is written in the background. With
+        // heat, see -ssa2dot-heat, the graph is colored by it.
+        // Functions above -ssa2dot-page-size are written as pages. The
+        // source files of -ssa2dot-source are read through sourceIndexes,
+        // see SourceIndexCache.
+        void writeFunctionGraph(const Function &F, AsyncGraphWriter *graphWriter = nullptr, const FunctionHeat *heat = nullptr,
+                                SourceIndexCache *sourceIndexes = nullptr);
+
+        // The same, into the given file.
+        void writeFunctionGraph(const Function &F, const std::string &fileName, AsyncGraphWriter *graphWriter, const FunctionHeat *heat = nullptr,
+                                SourceIndexCache *sourceIndexes = nullptr);
+
+        // True if -ssa2dot-print-changed is given.
+        bool isPrintChangedEnabled();
+
+        // Writes every debuggable function of M into its own .dot file, on
+        // the given number of threads (0 uses all cores). The module
+        // variants take the heat of the selected functions, if any.
+        void writeFunctionGraphs(const Module &M, unsigned int threads, const ModuleHeat *heat = nullptr);
+
+        // Writes every debuggable function of M into a single <source>.dot
+        // file, one subgraph per function, rendered on the given number of
+        // threads (0 uses all cores).
+        void writeModuleGraph(const Module &M, unsigned int threads, const ModuleHeat *heat = nullptr);
+
+        // Writes the graphs of every debuggable function of M into a single
+        // <source>.dotbundle file, or the bundle of the -ssa2dot-format,
+        // with an index by function name, see
+        // GraphBundle. The graphs are the ones writeFunctionGraph writes.
+        void writeGraphBundle(const Module &M, unsigned int threads, const ModuleHeat *heat = nullptr);
+
+        // Numbering of a function's graph. Blocks are numbered from 100 in
+        // layout order and instructions by their position inside the block,
+        // node names are only formatted when they are written.
+        struct GraphMetadata
+        {
+          DenseMap<const BasicBlock*, unsigned int> basicBlockToNumber;
+          StringRef nodePrefix;
+          const FunctionHeat *heat = nullptr;
+          const GraphPage *page = nullptr;
+          SourceIndexCache *sourceIndexes = nullptr;
+        };
+
+        // Page of a function too large for one graph, see -ssa2dot-page-size.
+        // Pages hold whole blocks in layout order, pageStarts the number of
+        // the first block of every page. Edges to a block on another page
+        // end at a stub node naming that page and block.
+        struct GraphPage
+        {
+          unsigned int number;
+          ArrayRef<unsigned int> pageStarts;
+
+          bool contains(unsigned int blockNumber) const
+          {
+            return blockNumber >= pageStarts[number] && (number + 1 == pageStarts.size() || blockNumber < pageStarts[number + 1]);
+          }
+
+          unsigned int pageOf(unsigned int blockNumber) const
+          {
+            return std::upper_bound(pageStarts.begin(), pageStarts.end(), blockNumber) - pageStarts.begin() - 1;
+          }
+        };
+
+        // The page starts of F, empty if F is within -ssa2dot-page-size and
+        // gets a single graph. The file or bundle entry of a page is named
+        // like that of F, with .page<n> appended, counting from 1.
+        std::vector<unsigned int> paginateFunction(const Function &F);
+        std::string pageFileName(StringRef fileName, unsigned int pageNumber);
+
+        // -ssa2dot-page-size, 0 if functions are never split.
+        unsigned int pageSizeLimit();
+
+        // Relative frequencies of -ssa2dot-heat, between 0 and 1: of every
+        // block, relative to the hottest block of the function, and of every
+        // edge from a block to the successor with the given index. Blocks
+        // below -ssa2dot-cold-threshold are collapsed into a single node.
+        struct FunctionHeat
+        {
+          DenseMap<const BasicBlock*, double> blockHeat;
+          DenseMap<std::pair<const BasicBlock*, unsigned int>, double> edgeHeat;
+          DenseSet<const BasicBlock*> coldBlocks;
+        };
+
+        // Heat from the block frequencies and branch probabilities of the
+        // analysis manager, see ssa2dotHeat.cpp. Only computed when
+        // -ssa2dot-heat is given.
+        bool isHeatEnabled();
+        FunctionHeat computeFunctionHeat(Function &F, FunctionAnalysisManager &FAM);
+        ModuleHeat computeModuleHeat(Module &M, FunctionAnalysisManager &FAM);
+
+        // What a node of the graph stands for. Together with its numbers a
+        // node is identified the same way by every backend:
+        //
+        //   FunctionName, Arguments  the function and its arguments
+        //   Instruction   first is the block, second the instruction number
+        //   Block         first is the block number
+        //   UseSummary    stands for the users of the instruction first_second
+        //   ArgumentUseSummary  the users of argument first
+        //   SourceLine    first is the line number
+        //   PageStub      stands for block first on page second of a paginated
+        //                 function
+        enum class NodeKind : uint32_t { FunctionName, Arguments, Instruction, Block, UseSummary, ArgumentUseSummary, SourceLine, PageStub };
+
+        struct GraphNode
+        {
+          NodeKind kind;
+          unsigned int first = 0;
+          unsigned int second = 0;
+        };
+
+        // Entry edges lead from the function name to the first node, sequence
+        // edges chain the instructions of a block. Successor edges leave the
+        // blocks of other terminators, e.g. indirectbr, in block granularity.
+        enum class EdgeKind : uint32_t { Entry, Sequence, Branch, SwitchDefault, SwitchCase, Invoke, Successor, DefUse, SourceLine };
+
+        // The "LLVM" cluster of a function, the cluster of a basic block and
+        // the "C" cluster of its source lines.
+        enum class ClusterKind : uint32_t { Function, Block, Source };
+
+        using LabelWriter = function_ref<void(raw_ostream &labelStream)>;
+
+        // Serializes a graph as the IR walk produces it. Every function is
+        // emitted between beginFunction and endFunction by an emitter of its
+        // own, so that functions rendered apart, e.g. on several threads, can
+        // be written one after another. beginGraph and endGraph surround the
+        // functions of a file. Labels are written by callbacks, straight into
+        // the output where the backend allows it.
+        class GraphEmitter
+        {
+        public:
+          virtual ~GraphEmitter();
+
+          virtual void beginGraph() {}
+          virtual void endGraph() {}
+
+          virtual void beginFunction(StringRef functionName, StringRef nodePrefix) = 0;
+          virtual void endFunction() = 0;
+
+          virtual void beginCluster(ClusterKind kind, unsigned int number, StringRef label) = 0;
+          virtual void endCluster() = 0;
+
+          // A node with a label. isReturn marks the nodes of return
+          // instructions and blocks.
+          virtual void node(const GraphNode &node, LabelWriter writeLabel, bool isReturn = false) = 0;
+
+          // A block of block granularity, writeRows writes one line per
+          // instruction.
+          virtual void blockNode(const GraphNode &node, StringRef blockName, LabelWriter writeRows, bool isReturn) = 0;
+
+          virtual void edge(const GraphNode &from, const GraphNode &to, EdgeKind kind) = 0;
+
+          // Relative frequency of the cluster, node or edge emitted next,
+          // see -ssa2dot-heat. The binary backend leaves it out.
+          virtual void heat(double) {}
+
+          // Position of a node emitted before, the center in points with y
+          // growing upwards, see -ssa2dot-layout. Only DOT writes positions.
+          virtual void position(const GraphNode &, double, double) {}
+        };
+
+        // Emitter of the -ssa2dot-format backend writing into the stream, and
+        // the extension of its files.
+        std::unique_ptr<GraphEmitter> createGraphEmitter(raw_ostream &graphStream);
+        StringRef graphFileExtension();
+
+        // The built-in layered layout of -ssa2dot-layout, see
+        // ssa2dotLayout.cpp. The layout emitter passes everything on to the
+        // given emitter and adds the positions of the nodes at the end of F.
+        bool isLayoutEnabled();
+        std::unique_ptr<GraphEmitter> createLayoutEmitter(const Function &F, const GraphMetadata &metaData, std::unique_ptr<GraphEmitter> emitter);
+
+        // The stages of a graph, also timed one by one by ssa2dot-bench.
+        // writeGraph writes the digraph around the clusters that the callback
+        // renders into the file, e.g. with renderFunctionCluster, which maps
+        // the nodes, labels the instructions and emits the branch edges.
+        GraphMetadata mapInstructionToNodeIdentifier(const Function &F, StringRef nodePrefix);
+        void renderFunctionCluster(const Function &F, StringRef nodePrefix, raw_ostream &llvmMainClusterStream, const FunctionHeat *heat = nullptr,
+                                   const GraphPage *page = nullptr, SourceIndexCache *sourceIndexes = nullptr);
+        void renderBranchEdges(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter);
+        bool writeGraph(const std::string &fileName, function_ref<void(raw_ostream &graphStream)> writeClusters);
+
+        // The digraph around the clusters, into any stream, and the writing
+        // of an already rendered graph. writeGraph is the two in one.
+        void renderGraph(raw_ostream &graphStream, function_ref<void(raw_ostream &graphStream)> writeClusters);
+        bool writeGraphFile(const std::string &fileName, StringRef graph);
+
+        // Writes rendered graphs on a background thread, in the order they
+        // are queued, so that rendering goes on while files are written. At
+        // most queueLimit graphs wait, queueing another blocks until one is
+        // written. Failed writes are reported as they happen and counted for
+        // flush, the destructor flushes.
+        class AsyncGraphWriter
+        {
+        public:
+          explicit AsyncGraphWriter(unsigned int queueLimit);
+          ~AsyncGraphWriter();
+
+          // Takes the graph over, the cache entry is recorded once the file
+          // is written.
+          void write(std::string fileName, std::string graph, const MD5::MD5Result &contentHash);
+
+          // Waits for every queued graph. Fails if any graph queued since the
+          // last flush could not be written.
+          Error flush();
+
+        private:
+          struct PendingGraph
+          {
+            std::string fileName;
+            std::string graph;
+            MD5::MD5Result contentHash;
+          };
+
+          void writeQueuedGraphs();
+
+          unsigned int queueLimit;
+          std::deque<PendingGraph> queue;
+          bool writing = false;
+          bool stopping = false;
+          std::vector<std::string> failedFiles;
+
+          std::mutex queueMutex;
+          std::condition_variable queueChanged;
+          std::thread writerThread;
+        };
+
+        // -ssa2dot-write-queue, 0 if graphs are written synchronously.
+        unsigned int writeQueueLimit();
+
+        // Bundle of graphs, one per function, followed by an index sorted by
+        // function name, see ssa2dotBundle.cpp for the layout. The writer
+        // streams the graphs into the file as they are added and writes the
+        // index on finish, the destructor finishes.
+        class GraphBundleWriter
+        {
+        public:
+          explicit GraphBundleWriter(std::string fileName);
+          ~GraphBundleWriter();
+
+          // Appends the graph of a function, renderGraph writes it into the
+          // bundle.
+          void addGraph(StringRef functionName, function_ref<void(raw_ostream &bundleStream)> renderGraph);
+
+          // Adds an index entry for a function sharing the graph added as
+          // targetName, the graph is stored once. Returns false if there is
+          // no such graph or functionName is in the index already, the
+          // function then needs a graph of its own.
+          bool addAlias(StringRef functionName, StringRef targetName);
+
+          // The same for several (functionName, targetName) pairs, e.g. the
+          // pages of a function. Adds all of them or, if one fails, none.
+          bool addAliases(ArrayRef<std::pair<std::string, std::string>> aliases);
+
+          // Writes the index. Fails if the bundle could not be written.
+          Error finish();
+
+        private:
+          struct IndexEntry
+          {
+            std::string functionName;
+            uint64_t graphOffset;
+            uint64_t graphSize;
+          };
+
+          std::string fileName;
+          std::unique_ptr<raw_fd_ostream> bundleStream;
+          std::error_code openError;
+          std::vector<IndexEntry> index;
+          StringMap<size_t> indexPositions;
+          bool finished = false;
+        };
+
+        // Reads single graphs out of a bundle. The bundle is memory-mapped,
+        // a lookup only touches the trailer, the index entries of its binary
+        // search and the graph itself.
+        class GraphBundle
+        {
+        public:
+          static Expected<std::unique_ptr<GraphBundle>> open(StringRef fileName);
+          ~GraphBundle();
+
+          // The graph of the function, a reference into the mapped bundle,
+          // or an error if the bundle has no such function.
+          Expected<StringRef> lookup(StringRef functionName) const;
+
+          // The file extension of the format the graphs were written in,
+          // e.g. .dot, see -ssa2dot-format.
+          StringRef graphExtension() const;
+
+        private:
+          GraphBundle(std::unique_ptr<MemoryBuffer> bundleBuffer, std::string extension, uint64_t indexOffset, uint64_t entryCount);
+
+          std::unique_ptr<MemoryBuffer> bundleBuffer;
+          std::string extension;
+          uint64_t indexOffset;
+          uint64_t entryCount;
+        };
+
+        // -ssa2dot-bundle, the function pass writes a bundle per module
+        // instead of a file per function. The bundle is named after the
+        // graph format, .dotbundle for DOT graphs.
+        bool isBundleOutputEnabled();
+        std::string bundleFileExtension();
+
+        // With -ssa2dot-source, renders the "C" cluster of F's source lines
+        // and the edges from the nodes of F to them. Also hashed for the
+        // graph cache, so that edits to the source miss.
+        bool isSourceClusterEnabled();
+        void renderSourceCluster(const Function &F, const GraphMetadata &metaData, GraphEmitter &emitter);
+
+        // Memory-mapped source file with the offsets of its lines.
+        class SourceLineIndex
+        {
+        public:
+          // Reads and indexes the file, null if it cannot be read.
+          static std::shared_ptr<const SourceLineIndex> create(StringRef fileName);
+          ~SourceLineIndex();
+
+          unsigned int lineCount() const;
+          StringRef line(unsigned int lineNumber) const;
+
+        private:
+          explicit SourceLineIndex(std::unique_ptr<MemoryBuffer> sourceBuffer);
+
+          std::unique_ptr<MemoryBuffer> sourceBuffer;
+          std::vector<size_t> lineOffsets;
+        };
+
+        // The source files of one module, each indexed once on first use and
+        // shared by every function and render thread referring to it. Owned
+        // by whatever renders the module, so that the files are unmapped, and
+        // read again if edited, once it moves on.
+        class SourceIndexCache
+        {
+        public:
+          std::shared_ptr<const SourceLineIndex> get(StringRef fileName);
+
+        private:
+          std::mutex indexMutex;
+          StringMap<std::shared_ptr<const SourceLineIndex>> indexedFiles;
+        };
+
+        // Compact binary graphs of -ssa2dot-format=binary, one chunk per
+        // function. All fields are little endian and records have a fixed
+        // size, so a graph is read in place out of a memory-mapped file, see
+        // BinaryGraphFile. A chunk is laid out as
+        //
+        //   BinaryGraphHeader
+        //   BinaryClusterRecord[clusterCount]
+        //   BinaryNodeRecord[nodeCount]
+        //   BinaryEdgeRecord[edgeCount]
+        //   BinaryStringRecord[stringCount]
+        //   string data, padded to a multiple of 4
+        //
+        // Names and labels are indices into the string table of the chunk,
+        // in which every string is stored once, noString if there is none.
+        // Clusters, nodes and edges refer to each other by their index in the
+        // chunk, noCluster marks nodes outside of any cluster. The kinds are
+        // the numbers of ClusterKind, NodeKind and EdgeKind.
+        using BinaryField = support::ulittle32_t;
+
+        struct BinaryGraphHeader
+        {
+          char magic[8];
+          BinaryField version;
+          BinaryField chunkSize;
+          BinaryField functionName;
+          BinaryField clusterCount;
+          BinaryField nodeCount;
+          BinaryField edgeCount;
+          BinaryField stringCount;
+          BinaryField stringDataSize;
+        };
+
+        struct BinaryClusterRecord
+        {
+          BinaryField kind;
+          BinaryField number;
+          BinaryField label;
+          BinaryField parent;
+        };
+
+        struct BinaryNodeRecord
+        {
+          BinaryField kind;
+          BinaryField isReturn;
+          BinaryField cluster;
+          BinaryField first;
+          BinaryField second;
+          BinaryField name;
+          BinaryField label;
+        };
+
+        struct BinaryEdgeRecord
+        {
+          BinaryField from;
+          BinaryField to;
+          BinaryField kind;
+        };
+
+        struct BinaryStringRecord
+        {
+          BinaryField offset;
+          BinaryField size;
+        };
+
+        const uint32_t noCluster = ~0u;
+        const uint32_t noString = ~0u;
+
+        // One chunk, viewed in place.
+        struct BinaryGraph
+        {
+          const BinaryGraphHeader *header;
+          ArrayRef<BinaryClusterRecord> clusters;
+          ArrayRef<BinaryNodeRecord> nodes;
+          ArrayRef<BinaryEdgeRecord> edges;
+          ArrayRef<BinaryStringRecord> strings;
+          StringRef stringData;
+
+          StringRef string(uint32_t index) const;
+          StringRef functionName() const { return string(header->functionName); }
+        };
+
+        // A memory-mapped file of binary graphs, e.g. a module graph with one
+        // chunk per function. Opening it checks the chunk headers and the
+        // table sizes, nothing is copied.
+        class BinaryGraphFile
+        {
+        public:
+          static Expected<std::unique_ptr<BinaryGraphFile>> open(StringRef fileName);
+          static Expected<std::vector<BinaryGraph>> parse(StringRef data);
+          ~BinaryGraphFile();
+
+          ArrayRef<BinaryGraph> graphs() const { return chunks; }
+
+        private:
+          BinaryGraphFile(std::unique_ptr<MemoryBuffer> graphBuffer, std::vector<BinaryGraph> chunks);
+
+          std::unique_ptr<MemoryBuffer> graphBuffer;
+          std::vector<BinaryGraph> chunks;
+        };
+
+        // Where escaped text goes: a quoted ID or label or a record label.
+        enum class EscapeContext { Quoted, Record };
+
+        // Writes text escaped for the context in a single pass, see
+        // ssa2dotEscape.cpp.
+        void writeEscaped(raw_ostream &stream, StringRef text, EscapeContext context = EscapeContext::Quoted);
+
+        // Escapes everything written to it into outputStream, so that e.g. an
+        // instruction can be printed straight into its label.
+        class DotEscapingStream : public raw_ostream
+        {
+        public:
+          explicit DotEscapingStream(raw_ostream &outputStream, EscapeContext context = EscapeContext::Quoted);
+
+        private:
+          raw_ostream &outputStream;
+          EscapeContext context;
+          uint64_t bytesWritten = 0;
+
+          void write_impl(const char *data, size_t size) override;
+          uint64_t current_pos() const override;
+        };
+
+        // Prints the label of an instruction node, i.e. the instruction
+        // without its !dbg attachment. The slot tracker must have the
+        // instruction's function incorporated.
+        void printInstructionLabel(const Instruction &inst, ModuleSlotTracker &slotTracker, raw_ostream &labelStream);
+
+        // True if F passes -ssa2dot-filter, matched against its name and its
+        // demangled name. Only needs the name, so F may still be unmaterialized.
+        bool isFunctionSelected(const Function &F);
+
+        // The debuggable definitions of M that get a graph, after
+        // -ssa2dot-filter and the -ssa2dot-min-instructions, -ssa2dot-hottest
+        // and -ssa2dot-sample budgets.
+        DenseSet<const Function*> selectFunctions(const Module &M);
+
+        // The same selection by name, for the passes that keep it while other
+        // passes run. Passes may delete functions and create others at the
+        // same addresses, a name does not go stale that way.
+        StringSet<> selectFunctionNames(const Module &M);
+
+        // -ssa2dot-dedup, see ssa2dotDedup.cpp. Maps every selected function
+        // that renders like an earlier one of M to the earliest one, its
+        // representative, whose graph it shares. Functions that are not
+        // in the map are rendered as usual.
+        bool isDeduplicationEnabled();
+        DenseMap<const Function*, const Function*> findDuplicateFunctions(const Module &M, const DenseSet<const Function*> &selectedFunctions);
+
+        // The variant of the function pass, which sees one function at a time
+        // while other passes may change or delete the functions in between.
+        // Returns a function rendered earlier that F renders like, compared
+        // again now, or records F by name as rendered and returns null.
+        const Function *findRenderedDuplicate(const Function &F, RenderedFunctions &renderedFunctions);
+
+        // Links the graph file of F, or of each of its pages, to that of its
+        // representative. Returns false, with none of the links left, if a
+        // link could not be created, F then needs a graph of its own.
+        bool linkFunctionGraph(const Function &F, const Function &representative);
+
+        // The bundle entries of F and of its representative, one per page.
+        // Returns false, with none of the entries added, if the
+        // representative lacks one or F has one already.
+        bool addBundleAliases(GraphBundleWriter &bundleWriter, const Function &F, const Function &representative);
+
+        // Writes the values of the options that change the rendered graph.
+        void printRenderOptions(raw_ostream &optionStream);
+
+        // Writes what the labels and names in the graph of F are made of
+        // into hashStream, without printing the labels. Shared by the content
+        // hash and -ssa2dot-print-changed, see ssa2dotCache.cpp.
+        void hashFunctionStructure(raw_ostream &hashStream, const Function &F);
+
+        // Graph cache, see -ssa2dot-cache-dir. A graph only needs to be
+        // rendered again when the content hash of its function changed.
+        bool isGraphCacheEnabled();
+        MD5::MD5Result hashFunctionContent(const Function &F, StringRef nodePrefix, const FunctionHeat *heat = nullptr,
+                                           SourceIndexCache *sourceIndexes = nullptr);
+        bool isGraphUpToDate(StringRef fileName, const MD5::MD5Result &contentHash);
+        void recordGraph(StringRef fileName, const MD5::MD5Result &contentHash);
+
+    } // namespace ssa2dot
+
 } // namespace llvm
 
 #endif // LLVM_TRANSFORMS_HELLONEW_HELLOWORLD_H
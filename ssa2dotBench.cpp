@@ -0,0 +1,489 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotBench.cpp - Benchmark of the SSA to DOT pass ---------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Builds a synthetic function of the requested shape in memory and times the
+// stages of the pass on it one by one: numbering the nodes, labeling the
+// instructions, emitting the branch edges and writing the whole graph. With
+// -json the results are printed in a machine-readable form, so they can be
+// compared across releases.
+//
+// The heap allocations of every stage are counted as well. Labeling and
+// writing the graph must not allocate per instruction, a run where they do
+// more often than -max-allocations-per-instruction fails.
+//
+// -labeling-scaling instead times the labeling stage on functions of growing
+// size. The time per instruction should stay flat with a shared slot tracker,
+// while printing every instruction with operator<< grows with the function.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+using namespace llvm;
+
+static cl::OptionCategory shapeCategory("Shape of the synthetic function");
+
+static cl::opt<unsigned> basicBlocks("blocks",
+    cl::desc("Number of basic blocks (default 256)"),
+    cl::init(256), cl::cat(shapeCategory));
+
+static cl::opt<unsigned> instructionsPerBlock("instructions-per-block",
+    cl::desc("Instructions per basic block, including the terminator (default 16)"),
+    cl::init(16), cl::cat(shapeCategory));
+
+static cl::opt<unsigned> switchFanOut("switch-fan-out",
+    cl::desc("Successors of every block but the last, more than one ends the block in a switch (default 1)"),
+    cl::init(1), cl::cat(shapeCategory));
+
+static cl::opt<unsigned> argumentCount("arguments",
+    cl::desc("Number of i32 arguments (default 2)"),
+    cl::init(2), cl::cat(shapeCategory));
+
+static cl::opt<double> debugDensity("debug-density",
+    cl::desc("Fraction of the instructions with a debug location, from 0 to 1 (default 1)"),
+    cl::init(1.0), cl::cat(shapeCategory));
+
+static cl::opt<unsigned> repetitions("repetitions",
+    cl::desc("Times every stage is run, the fastest run is reported (default 5)"),
+    cl::init(5));
+
+static cl::opt<bool> jsonOutput("json",
+    cl::desc("Print the results as JSON"),
+    cl::init(false));
+
+static cl::opt<double> maxAllocationsPerInstruction("max-allocations-per-instruction",
+    cl::desc("Fail if labeling or writeGraph allocate more often than this per instruction, negative disables (default 0.1)"),
+    cl::init(0.1));
+
+static cl::opt<bool> labelingScaling("labeling-scaling",
+    cl::desc("Compare the labeling stage with operator<< on functions of growing size instead"),
+    cl::init(false));
+
+static cl::opt<unsigned> maxInstructions("max-instructions",
+    cl::desc("Largest synthetic function of -labeling-scaling, in instructions (default 65536)"),
+    cl::init(65536));
+
+static cl::opt<unsigned> maxOperatorInstructions("max-operator-instructions",
+    cl::desc("Largest function of -labeling-scaling also labeled with operator<< (default 8192)"),
+    cl::init(8192));
+
+
+// Fastest run of a stage, the bytes it produced and the heap allocations of
+// its last run.
+struct StageResult
+{
+  const char *name;
+  double seconds;
+  uint64_t bytes;
+  uint64_t allocations;
+};
+
+
+// Every operator new of the benchmark is counted, so that the stages can be
+// checked for allocations per instruction.
+static std::atomic<uint64_t> heapAllocations(0);
+
+void *operator new(size_t size)
+{
+  heapAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = std::malloc(size ? size : 1))
+  {
+    return memory;
+  }
+  report_bad_alloc_error("ssa2dot-bench: out of memory");
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept
+{
+  std::free(memory);
+}
+
+
+Function *buildChainFunction(Module &M, unsigned instructionCount);
+Function *buildShapedFunction(Module &M);
+double secondsSince(std::chrono::steady_clock::time_point start);
+StageResult timeStage(const char *name, function_ref<uint64_t()> runStage);
+bool runStageBenchmark();
+void runLabelingScaling();
+
+
+// Builds a function with a single block of chained adds. The values are left
+// unnamed, as in unoptimized clang output, so printing them needs slot numbers.
+Function *buildChainFunction(Module &M, unsigned instructionCount)
+{
+  LLVMContext &context = M.getContext();
+  Type *intType = Type::getInt32Ty(context);
+
+  FunctionType *functionType = FunctionType::get(intType, {intType}, false);
+  Function *F = Function::Create(functionType, Function::ExternalLinkage, "chain", M);
+
+  IRBuilder<> builder(BasicBlock::Create(context, "entry", F));
+
+  Value *value = F->getArg(0);
+  for (unsigned i = 0; i + 1 < instructionCount; ++i)
+  {
+    value = builder.CreateAdd(value, builder.getInt32(i));
+  }
+  builder.CreateRet(value);
+
+  return F;
+}
+
+
+// Builds a function of the shape given on the command line. Every block is a
+// chain of unnamed adds starting from one of the arguments, followed by a
+// branch or a switch to the next blocks. The last block returns. The function
+// always has a subprogram, so the pass renders it, and debugDensity of its
+// instructions get a debug location.
+Function *buildShapedFunction(Module &M)
+{
+  LLVMContext &context = M.getContext();
+  Type *intType = Type::getInt32Ty(context);
+
+  unsigned blockCount = std::max(basicBlocks.getValue(), 1u);
+  unsigned chainLength = std::max(instructionsPerBlock.getValue(), 1u) - 1;
+
+  std::vector<Type*> argumentTypes(argumentCount, intType);
+  FunctionType *functionType = FunctionType::get(intType, argumentTypes, false);
+  Function *F = Function::Create(functionType, Function::ExternalLinkage, "shaped", M);
+
+  DIBuilder debugBuilder(M);
+  DIFile *file = debugBuilder.createFile("shaped.c", ".");
+  debugBuilder.createCompileUnit(dwarf::DW_LANG_C, file, "ssa2dot-bench", false, "", 0);
+  DISubprogram *subprogram = debugBuilder.createFunction(file, "shaped", "shaped", file, 1,
+      debugBuilder.createSubroutineType(debugBuilder.getOrCreateTypeArray({})), 1,
+      DINode::FlagZero, DISubprogram::SPFlagDefinition);
+  F->setSubprogram(subprogram);
+
+  std::vector<BasicBlock*> blocks;
+  for (unsigned i = 0; i < blockCount; ++i)
+  {
+    blocks.push_back(BasicBlock::Create(context, "block" + std::to_string(i), F));
+  }
+
+  // Spreads the debug locations evenly, without a random number generator,
+  // so that every run builds the same function.
+  double debugCredit = 0;
+  unsigned line = 1;
+
+  IRBuilder<> builder(context);
+  for (unsigned i = 0; i < blockCount; ++i)
+  {
+    builder.SetInsertPoint(blocks[i]);
+
+    Value *value = argumentCount ? static_cast<Value*>(F->getArg(i % argumentCount)) : builder.getInt32(0);
+    for (unsigned j = 0; j < chainLength; ++j)
+    {
+      value = builder.CreateAdd(value, builder.getInt32(j));
+    }
+
+    if (i + 1 == blockCount)
+    {
+      builder.CreateRet(value);
+    }
+    else if (switchFanOut <= 1)
+    {
+      builder.CreateBr(blocks[i + 1]);
+    }
+    else
+    {
+      // The entry block cannot be a successor, the targets wrap around the
+      // other blocks.
+      auto target = [&](unsigned k) { return blocks[1 + (i + k) % (blockCount - 1)]; };
+
+      SwitchInst *switchInstruction = builder.CreateSwitch(value, target(0), switchFanOut - 1);
+      for (unsigned k = 1; k < switchFanOut; ++k)
+      {
+        switchInstruction->addCase(builder.getInt32(k), target(k));
+      }
+    }
+
+    for (Instruction &inst : *blocks[i])
+    {
+      debugCredit += debugDensity;
+      if (debugCredit >= 1)
+      {
+        debugCredit -= 1;
+        inst.setDebugLoc(DILocation::get(context, line++, 1, subprogram));
+      }
+    }
+  }
+
+  debugBuilder.finalize();
+  return F;
+}
+
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Runs a stage repetitions times and keeps the fastest run. runStage returns
+// the number of bytes the stage produced.
+StageResult timeStage(const char *name, function_ref<uint64_t()> runStage)
+{
+  StageResult result = {name, 0, 0, 0};
+
+  for (unsigned i = 0; i < std::max(repetitions.getValue(), 1u); ++i)
+  {
+    uint64_t allocationsBefore = heapAllocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t bytes = runStage();
+    double seconds = secondsSince(start);
+    result.allocations = heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+    if (i == 0 || seconds < result.seconds)
+    {
+      result.seconds = seconds;
+    }
+    result.bytes = bytes;
+  }
+
+  return result;
+}
+
+
+// Returns false if a stage allocates per instruction.
+bool runStageBenchmark()
+{
+  LLVMContext context;
+  Module M("bench", context);
+  M.setSourceFileName("shaped.c");
+  Function *F = buildShapedFunction(M);
+
+  uint64_t instructionCount = F->getInstructionCount();
+
+  SmallString<128> graphFile;
+  if (std::error_code errorCode = sys::fs::createTemporaryFile("ssa2dot-bench", "dot", graphFile))
+  {
+    errs() << "Could not create a temporary file: " << errorCode.message() << "\n";
+    return false;
+  }
+
+  std::vector<StageResult> results;
+
+  results.push_back(timeStage("mapInstructionToNodeIdentifier", [F]()
+  {
+    ssa2dot::GraphMetadata metaData = ssa2dot::mapInstructionToNodeIdentifier(*F, "");
+    return uint64_t(0);
+  }));
+
+  results.push_back(timeStage("labeling", [&M, F]()
+  {
+    std::string labels;
+    raw_string_ostream labelStream(labels);
+
+    ModuleSlotTracker slotTracker(&M, false);
+    slotTracker.incorporateFunction(*F);
+    for (const Instruction &inst : instructions(*F))
+    {
+      ssa2dot::printInstructionLabel(inst, slotTracker, labelStream);
+    }
+    labelStream.flush();
+
+    return uint64_t(labels.size());
+  }));
+
+  ssa2dot::GraphMetadata metaData = ssa2dot::mapInstructionToNodeIdentifier(*F, "");
+  results.push_back(timeStage("edgeEmission", [F, &metaData]()
+  {
+    std::string edges;
+    raw_string_ostream edgeStream(edges);
+    std::unique_ptr<ssa2dot::GraphEmitter> emitter = ssa2dot::createGraphEmitter(edgeStream);
+    emitter->beginFunction(F->getName(), "");
+    ssa2dot::renderBranchEdges(*F, metaData, *emitter);
+    emitter->endFunction();
+    edgeStream.flush();
+
+    return uint64_t(edges.size());
+  }));
+
+  results.push_back(timeStage("writeGraph", [F, &graphFile]()
+  {
+    ssa2dot::writeGraph(graphFile.str().str(), [F](raw_ostream &graphStream)
+    {
+      ssa2dot::renderFunctionCluster(*F, "", graphStream);
+    });
+
+    uint64_t fileSize = 0;
+    sys::fs::file_size(graphFile, fileSize);
+    return fileSize;
+  }));
+
+  sys::fs::remove(graphFile);
+
+  auto perSecond = [](uint64_t amount, double seconds)
+  {
+    return seconds > 0 ? amount / seconds : 0.0;
+  };
+
+  bool allocationsWithinLimit = true;
+  for (const StageResult &result : results)
+  {
+    bool isChecked = StringRef(result.name) == "labeling" || StringRef(result.name) == "writeGraph";
+    double allocationsPerInstruction = double(result.allocations) / instructionCount;
+    if (isChecked && maxAllocationsPerInstruction >= 0 && allocationsPerInstruction > maxAllocationsPerInstruction)
+    {
+      errs() << result.name << " allocates " << format("%.3f", allocationsPerInstruction) << " times per instruction, more than "
+             << format("%g", maxAllocationsPerInstruction.getValue()) << "\n";
+      allocationsWithinLimit = false;
+    }
+  }
+
+  if (!jsonOutput)
+  {
+    outs() << instructionCount << " instructions in " << basicBlocks << " blocks\n";
+    outs() << "stage                             seconds      inst/s     bytes/s  allocs/inst\n";
+    for (const StageResult &result : results)
+    {
+      outs() << format("%-30s %10.6f %11.4g %11.4g %12.3f\n", result.name, result.seconds,
+                       perSecond(instructionCount, result.seconds), perSecond(result.bytes, result.seconds),
+                       double(result.allocations) / instructionCount);
+    }
+    return allocationsWithinLimit;
+  }
+
+  json::OStream jsonStream(outs(), 2);
+  jsonStream.object([&]()
+  {
+    jsonStream.attribute("llvmVersion", LLVM_VERSION_STRING);
+    jsonStream.attributeObject("shape", [&]()
+    {
+      jsonStream.attribute("blocks", int64_t(basicBlocks));
+      jsonStream.attribute("instructionsPerBlock", int64_t(instructionsPerBlock));
+      jsonStream.attribute("switchFanOut", int64_t(switchFanOut));
+      jsonStream.attribute("arguments", int64_t(argumentCount));
+      jsonStream.attribute("debugDensity", debugDensity.getValue());
+    });
+    jsonStream.attribute("instructions", int64_t(instructionCount));
+    jsonStream.attributeArray("stages", [&]()
+    {
+      for (const StageResult &result : results)
+      {
+        jsonStream.object([&]()
+        {
+          jsonStream.attribute("name", result.name);
+          jsonStream.attribute("seconds", result.seconds);
+          jsonStream.attribute("bytes", int64_t(result.bytes));
+          jsonStream.attribute("instructionsPerSecond", perSecond(instructionCount, result.seconds));
+          jsonStream.attribute("bytesPerSecond", perSecond(result.bytes, result.seconds));
+          jsonStream.attribute("allocations", int64_t(result.allocations));
+          jsonStream.attribute("allocationsPerInstruction", double(result.allocations) / instructionCount);
+        });
+      }
+    });
+  });
+  outs() << "\n";
+
+  return allocationsWithinLimit;
+}
+
+
+void runLabelingScaling()
+{
+  outs() << "instructions  tracker ns/inst  operator<< ns/inst\n";
+
+  for (unsigned instructionCount = 1024; instructionCount <= maxInstructions; instructionCount *= 2)
+  {
+    LLVMContext context;
+    Module M("bench", context);
+    Function *F = buildChainFunction(M, instructionCount);
+
+    std::string labels;
+    raw_string_ostream labelStream(labels);
+
+    auto start = std::chrono::steady_clock::now();
+
+    ModuleSlotTracker slotTracker(&M, false);
+    slotTracker.incorporateFunction(*F);
+    for (const Instruction &inst : F->getEntryBlock())
+    {
+      ssa2dot::printInstructionLabel(inst, slotTracker, labelStream);
+    }
+    labelStream.flush();
+
+    double trackerSeconds = secondsSince(start);
+
+    outs() << format("%12u %16.1f", instructionCount, trackerSeconds * 1e9 / instructionCount);
+
+    if (instructionCount <= maxOperatorInstructions)
+    {
+      labels.clear();
+      start = std::chrono::steady_clock::now();
+
+      for (const Instruction &inst : F->getEntryBlock())
+      {
+        labelStream << inst;
+      }
+      labelStream.flush();
+
+      outs() << format(" %19.1f", secondsSince(start) * 1e9 / instructionCount);
+    }
+
+    outs() << "\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  cl::ParseCommandLineOptions(argc, argv, "SSA to DOT benchmark\n");
+
+  if (labelingScaling)
+  {
+    runLabelingScaling();
+    return 0;
+  }
+
+  return runStageBenchmark() ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotBinaryGraph.cpp - Binary graph backend and reader ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Writes a function's graph as a chunk of fixed-size records, see
+// BinaryGraphHeader for the layout, and reads chunks in place. The emitter
+// keeps the records of one function in memory and writes the chunk when the
+// function ends, since edges may lead to nodes that come later. The reader
+// only checks that the tables of each chunk fit, the records are used where
+// they are mapped.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+
+using namespace llvm;
+using ssa2dot::BinaryClusterRecord;
+using ssa2dot::BinaryEdgeRecord;
+using ssa2dot::BinaryGraph;
+using ssa2dot::BinaryGraphHeader;
+using ssa2dot::BinaryNodeRecord;
+using ssa2dot::BinaryStringRecord;
+using ssa2dot::ClusterKind;
+using ssa2dot::EdgeKind;
+using ssa2dot::GraphNode;
+using ssa2dot::LabelWriter;
+
+static const char binaryGraphMagic[] = "ssa2dotG";
+static const uint32_t binaryGraphVersion = 1;
+
+std::unique_ptr<ssa2dot::GraphEmitter> createBinaryGraphEmitter(raw_ostream &graphStream);
+
+
+
+class BinaryGraphEmitter : public ssa2dot::GraphEmitter
+{
+public:
+  explicit BinaryGraphEmitter(raw_ostream &graphStream) : graphStream(graphStream)
+  {
+  }
+
+  void beginFunction(StringRef functionName, StringRef) override
+  {
+    this->functionName = internString(functionName);
+  }
+
+  void endFunction() override
+  {
+    // Edges are resolved once every node is known. Nodes that were never
+    // emitted get a record without a label, as DOT would create them.
+    std::vector<BinaryEdgeRecord> edgeRecords;
+    edgeRecords.reserve(edges.size());
+    for (const PendingEdge &edge : edges)
+    {
+      BinaryEdgeRecord record;
+      record.from = nodeIndex(edge.from);
+      record.to = nodeIndex(edge.to);
+      record.kind = static_cast<uint32_t>(edge.kind);
+      edgeRecords.push_back(record);
+    }
+
+    uint32_t stringDataSize = alignTo(stringData.size(), 4);
+    stringData.resize(stringDataSize, '\0');
+
+    BinaryGraphHeader header;
+    memcpy(header.magic, binaryGraphMagic, sizeof(header.magic));
+    header.version = binaryGraphVersion;
+    header.chunkSize = sizeof(BinaryGraphHeader) + clusters.size() * sizeof(BinaryClusterRecord) +
+                       nodes.size() * sizeof(BinaryNodeRecord) + edgeRecords.size() * sizeof(BinaryEdgeRecord) +
+                       strings.size() * sizeof(BinaryStringRecord) + stringDataSize;
+    header.functionName = functionName;
+    header.clusterCount = clusters.size();
+    header.nodeCount = nodes.size();
+    header.edgeCount = edgeRecords.size();
+    header.stringCount = strings.size();
+    header.stringDataSize = stringDataSize;
+
+    writeRecords(ArrayRef<BinaryGraphHeader>(header));
+    writeRecords(ArrayRef<BinaryClusterRecord>(clusters));
+    writeRecords(ArrayRef<BinaryNodeRecord>(nodes));
+    writeRecords(ArrayRef<BinaryEdgeRecord>(edgeRecords));
+    writeRecords(ArrayRef<BinaryStringRecord>(strings));
+    graphStream << stringData;
+
+    clusters.clear();
+    openClusters.clear();
+    nodes.clear();
+    nodeIndices.clear();
+    edges.clear();
+    strings.clear();
+    stringIndices.clear();
+    stringData.clear();
+  }
+
+  void beginCluster(ClusterKind kind, unsigned int number, StringRef label) override
+  {
+    BinaryClusterRecord record;
+    record.kind = static_cast<uint32_t>(kind);
+    record.number = number;
+    record.label = internString(label);
+    record.parent = currentCluster();
+
+    openClusters.push_back(clusters.size());
+    clusters.push_back(record);
+  }
+
+  void endCluster() override
+  {
+    openClusters.pop_back();
+  }
+
+  void node(const GraphNode &node, LabelWriter writeLabel, bool isReturn) override
+  {
+    uint32_t index = nodeIndex(node);
+    nodes[index].isReturn = isReturn;
+    nodes[index].cluster = currentCluster();
+    nodes[index].label = internLabel(writeLabel);
+  }
+
+  void blockNode(const GraphNode &node, StringRef blockName, LabelWriter writeRows, bool isReturn) override
+  {
+    uint32_t index = nodeIndex(node);
+    nodes[index].isReturn = isReturn;
+    nodes[index].cluster = currentCluster();
+    nodes[index].name = internString(blockName);
+    nodes[index].label = internLabel(writeRows);
+  }
+
+  void edge(const GraphNode &from, const GraphNode &to, EdgeKind kind) override
+  {
+    edges.push_back({from, to, kind});
+  }
+
+private:
+  struct PendingEdge
+  {
+    GraphNode from;
+    GraphNode to;
+    EdgeKind kind;
+  };
+
+  raw_ostream &graphStream;
+  uint32_t functionName = ssa2dot::noString;
+
+  std::vector<BinaryClusterRecord> clusters;
+  SmallVector<uint32_t, 4> openClusters;
+  std::vector<BinaryNodeRecord> nodes;
+  DenseMap<std::pair<uint64_t, unsigned int>, uint32_t> nodeIndices;
+  std::vector<PendingEdge> edges;
+
+  std::vector<BinaryStringRecord> strings;
+  StringMap<uint32_t> stringIndices;
+  std::string stringData;
+  SmallString<256> labelBuffer;
+
+  uint32_t currentCluster() const
+  {
+    return openClusters.empty() ? ssa2dot::noCluster : openClusters.back();
+  }
+
+  // Index of the node's record, which is added on first use.
+  uint32_t nodeIndex(const GraphNode &node)
+  {
+    std::pair<uint64_t, unsigned int> key = {uint64_t(node.kind) << 32 | node.first, node.second};
+    auto [entry, inserted] = nodeIndices.try_emplace(key, nodes.size());
+    if (inserted)
+    {
+      BinaryNodeRecord record;
+      record.kind = static_cast<uint32_t>(node.kind);
+      record.isReturn = 0;
+      record.cluster = ssa2dot::noCluster;
+      record.first = node.first;
+      record.second = node.second;
+      record.name = ssa2dot::noString;
+      record.label = ssa2dot::noString;
+      nodes.push_back(record);
+    }
+    return entry->second;
+  }
+
+  uint32_t internString(StringRef text)
+  {
+    auto [entry, inserted] = stringIndices.try_emplace(text, strings.size());
+    if (inserted)
+    {
+      BinaryStringRecord record;
+      record.offset = stringData.size();
+      record.size = text.size();
+      strings.push_back(record);
+      stringData.append(text.begin(), text.end());
+    }
+    return entry->second;
+  }
+
+  uint32_t internLabel(LabelWriter writeLabel)
+  {
+    labelBuffer.clear();
+    raw_svector_ostream labelStream(labelBuffer);
+    writeLabel(labelStream);
+    return internString(labelBuffer.str());
+  }
+
+  template <typename Record>
+  void writeRecords(ArrayRef<Record> records)
+  {
+    graphStream.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+  }
+};
+
+
+
+std::unique_ptr<ssa2dot::GraphEmitter> createBinaryGraphEmitter(raw_ostream &graphStream)
+{
+  return std::make_unique<BinaryGraphEmitter>(graphStream);
+}
+
+
+
+StringRef ssa2dot::BinaryGraph::string(uint32_t index) const
+{
+  if (index >= strings.size())
+  {
+    return StringRef();
+  }
+
+  uint64_t offset = strings[index].offset;
+  uint64_t size = strings[index].size;
+  if (offset > stringData.size() || size > stringData.size() - offset)
+  {
+    return StringRef();
+  }
+  return stringData.substr(offset, size);
+}
+
+
+
+// Splits the data into chunks and their tables. Fails if a chunk is not
+// one, or its tables do not fit into it.
+Expected<std::vector<BinaryGraph>> ssa2dot::BinaryGraphFile::parse(StringRef data)
+{
+  std::vector<BinaryGraph> graphs;
+
+  auto malformed = [](uint64_t offset, const char *problem)
+  {
+    return createStringError(inconvertibleErrorCode(), "malformed binary graph at offset %llu: %s",
+                             static_cast<unsigned long long>(offset), problem);
+  };
+
+  uint64_t offset = 0;
+  while (offset < data.size())
+  {
+    StringRef chunk = data.drop_front(offset);
+    if (chunk.size() < sizeof(BinaryGraphHeader) || !chunk.startswith(StringRef(binaryGraphMagic, 8)))
+    {
+      return malformed(offset, "missing chunk header");
+    }
+
+    BinaryGraph graph;
+    graph.header = reinterpret_cast<const BinaryGraphHeader*>(chunk.data());
+    if (graph.header->version != binaryGraphVersion)
+    {
+      return malformed(offset, "unsupported version");
+    }
+
+    uint64_t chunkSize = graph.header->chunkSize;
+    uint64_t tableSize = uint64_t(graph.header->clusterCount) * sizeof(BinaryClusterRecord) +
+                         uint64_t(graph.header->nodeCount) * sizeof(BinaryNodeRecord) +
+                         uint64_t(graph.header->edgeCount) * sizeof(BinaryEdgeRecord) +
+                         uint64_t(graph.header->stringCount) * sizeof(BinaryStringRecord);
+    if (chunkSize > chunk.size() || sizeof(BinaryGraphHeader) + tableSize + graph.header->stringDataSize != chunkSize)
+    {
+      return malformed(offset, "tables do not fit the chunk");
+    }
+
+    const char *table = chunk.data() + sizeof(BinaryGraphHeader);
+    auto takeTable = [&table](auto *&records, uint64_t count)
+    {
+      records = reinterpret_cast<std::remove_reference_t<decltype(records)>>(table);
+      table += count * sizeof(*records);
+    };
+
+    const BinaryClusterRecord *clusters;
+    const BinaryNodeRecord *nodes;
+    const BinaryEdgeRecord *edges;
+    const BinaryStringRecord *strings;
+    takeTable(clusters, graph.header->clusterCount);
+    takeTable(nodes, graph.header->nodeCount);
+    takeTable(edges, graph.header->edgeCount);
+    takeTable(strings, graph.header->stringCount);
+
+    graph.clusters = makeArrayRef(clusters, graph.header->clusterCount);
+    graph.nodes = makeArrayRef(nodes, graph.header->nodeCount);
+    graph.edges = makeArrayRef(edges, graph.header->edgeCount);
+    graph.strings = makeArrayRef(strings, graph.header->stringCount);
+    graph.stringData = StringRef(table, graph.header->stringDataSize);
+
+    graphs.push_back(graph);
+    offset += chunkSize;
+  }
+
+  return graphs;
+}
+
+
+
+Expected<std::unique_ptr<ssa2dot::BinaryGraphFile>> ssa2dot::BinaryGraphFile::open(StringRef fileName)
+{
+  // Not null terminated and not volatile, so that the file gets mapped.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> graphBuffer = MemoryBuffer::getFile(fileName, false, false);
+  if (!graphBuffer)
+  {
+    return createFileError(fileName, graphBuffer.getError());
+  }
+
+  Expected<std::vector<BinaryGraph>> chunks = parse((*graphBuffer)->getBuffer());
+  if (!chunks)
+  {
+    return createFileError(fileName, chunks.takeError());
+  }
+
+  return std::unique_ptr<BinaryGraphFile>(new BinaryGraphFile(std::move(*graphBuffer), std::move(*chunks)));
+}
+
+
+
+ssa2dot::BinaryGraphFile::BinaryGraphFile(std::unique_ptr<MemoryBuffer> graphBuffer, std::vector<BinaryGraph> chunks)
+  : graphBuffer(std::move(graphBuffer)), chunks(std::move(chunks))
+{
+}
+
+
+
+ssa2dot::BinaryGraphFile::~BinaryGraphFile() = default;
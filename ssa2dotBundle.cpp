@@ -0,0 +1,343 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotBundle.cpp - Graphs of a module in one indexed file --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// A bundle holds the graphs of a module's functions in a single file instead
+// of one file per function, <source>.dotbundle for DOT graphs or, with
+// another -ssa2dot-format, its extension followed by "bundle". All numbers
+// are 64 bit little endian:
+//
+//   header   "ssa2dotB" and the graph format, the graph file extension
+//            without its dot, padded with zeros to 8 bytes
+//   graphs   the graphs of the functions, back to back, in the order they
+//            were added
+//   names    the function names, back to back
+//   index    one entry per function: graph offset, graph size, name offset
+//            and name size, sorted by name. Functions sharing a graph have
+//            entries pointing at the same one
+//   trailer  index offset, entry count, "ssa2dotI"
+//
+// The trailer has a fixed size at the end of the file, so a reader finds the
+// index without looking at the graphs and finds a graph by a binary search
+// over the index.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+using namespace llvm;
+
+static cl::opt<bool> bundleOutput("ssa2dot-bundle",
+    cl::desc("Write the graphs of a module into one indexed <source>.dotbundle, or the bundle of the -ssa2dot-format, instead of a file per function"),
+    cl::init(false));
+
+static const char bundleHeader[] = "ssa2dotB";
+static const char bundleTrailer[] = "ssa2dotI";
+static const uint64_t magicSize = 8;
+static const uint64_t headerSize = 2 * magicSize;
+static const uint64_t indexEntrySize = 4 * sizeof(uint64_t);
+static const uint64_t trailerSize = 2 * sizeof(uint64_t) + magicSize;
+
+void writeNumber(raw_ostream &bundleStream, uint64_t number);
+
+
+
+bool ssa2dot::isBundleOutputEnabled()
+{
+  return bundleOutput;
+}
+
+
+
+std::string ssa2dot::bundleFileExtension()
+{
+  return (graphFileExtension() + "bundle").str();
+}
+
+
+
+void writeNumber(raw_ostream &bundleStream, uint64_t number)
+{
+  char bytes[sizeof(uint64_t)];
+  support::endian::write64le(bytes, number);
+  bundleStream.write(bytes, sizeof(bytes));
+}
+
+
+
+ssa2dot::GraphBundleWriter::GraphBundleWriter(std::string fileName)
+  : fileName(std::move(fileName))
+{
+  bundleStream = std::make_unique<raw_fd_ostream>(this->fileName, openError, sys::fs::OF_None);
+  if (!openError)
+  {
+    char graphFormat[magicSize] = {};
+    StringRef extension = graphFileExtension().drop_front();
+    memcpy(graphFormat, extension.data(), std::min<size_t>(extension.size(), magicSize));
+
+    bundleStream->write(bundleHeader, magicSize);
+    bundleStream->write(graphFormat, magicSize);
+  }
+}
+
+
+
+ssa2dot::GraphBundleWriter::~GraphBundleWriter()
+{
+  if (Error finishError = finish())
+  {
+    logAllUnhandledErrors(std::move(finishError), errs(), "ssa2dot: ");
+  }
+}
+
+
+
+void ssa2dot::GraphBundleWriter::addGraph(StringRef functionName, function_ref<void(raw_ostream &bundleStream)> renderGraph)
+{
+  if (openError || finished)
+  {
+    return;
+  }
+
+  uint64_t graphOffset = bundleStream->tell();
+  renderGraph(*bundleStream);
+  indexPositions[functionName] = index.size();
+  index.push_back({functionName.str(), graphOffset, bundleStream->tell() - graphOffset});
+}
+
+
+
+bool ssa2dot::GraphBundleWriter::addAlias(StringRef functionName, StringRef targetName)
+{
+  return addAliases({{functionName.str(), targetName.str()}});
+}
+
+
+
+// Every alias is checked before the first one is added, so that a failure
+// leaves the index as it was and the caller can add graphs under the names.
+bool ssa2dot::GraphBundleWriter::addAliases(ArrayRef<std::pair<std::string, std::string>> aliases)
+{
+  if (openError || finished)
+  {
+    return false;
+  }
+
+  for (const auto &[functionName, targetName] : aliases)
+  {
+    if (indexPositions.count(functionName))
+    {
+      errs() << "Could not add " << functionName << " to " << fileName << ": it has an entry already\n";
+      return false;
+    }
+    if (!indexPositions.count(targetName))
+    {
+      errs() << "Could not add " << functionName << " to " << fileName << ": no graph of " << targetName << "\n";
+      return false;
+    }
+  }
+
+  for (const auto &[functionName, targetName] : aliases)
+  {
+    IndexEntry entry = index[indexPositions.lookup(targetName)];
+    entry.functionName = functionName;
+    indexPositions[functionName] = index.size();
+    index.push_back(std::move(entry));
+  }
+  return true;
+}
+
+
+
+Error ssa2dot::GraphBundleWriter::finish()
+{
+  if (finished)
+  {
+    return Error::success();
+  }
+  finished = true;
+
+  if (openError)
+  {
+    return createFileError(fileName, openError);
+  }
+
+  llvm::sort(index, [](const IndexEntry &a, const IndexEntry &b)
+  {
+    return a.functionName < b.functionName;
+  });
+
+  std::vector<uint64_t> nameOffsets;
+  nameOffsets.reserve(index.size());
+  for (const IndexEntry &entry : index)
+  {
+    nameOffsets.push_back(bundleStream->tell());
+    *bundleStream << entry.functionName;
+  }
+
+  uint64_t indexOffset = bundleStream->tell();
+  for (size_t i = 0; i < index.size(); ++i)
+  {
+    writeNumber(*bundleStream, index[i].graphOffset);
+    writeNumber(*bundleStream, index[i].graphSize);
+    writeNumber(*bundleStream, nameOffsets[i]);
+    writeNumber(*bundleStream, index[i].functionName.size());
+  }
+
+  writeNumber(*bundleStream, indexOffset);
+  writeNumber(*bundleStream, index.size());
+  bundleStream->write(bundleTrailer, magicSize);
+
+  bundleStream->close();
+  if (bundleStream->has_error())
+  {
+    std::error_code writeError = bundleStream->error();
+    bundleStream->clear_error();
+    return createFileError(fileName, writeError);
+  }
+
+  return Error::success();
+}
+
+
+
+// Checks the header and the trailer, the index entries are only checked when
+// a lookup reads them.
+Expected<std::unique_ptr<ssa2dot::GraphBundle>> ssa2dot::GraphBundle::open(StringRef fileName)
+{
+  // Not null terminated and not volatile, so that the bundle gets mapped.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> bundleBuffer = MemoryBuffer::getFile(fileName, false, false);
+  if (!bundleBuffer)
+  {
+    return createFileError(fileName, bundleBuffer.getError());
+  }
+
+  StringRef bundle = (*bundleBuffer)->getBuffer();
+  auto malformed = [&fileName](const char *problem)
+  {
+    return createFileError(fileName, createStringError(inconvertibleErrorCode(), "not a graph bundle, %s", problem));
+  };
+
+  if (bundle.size() < headerSize + trailerSize || !bundle.startswith(StringRef(bundleHeader, magicSize)) ||
+      !bundle.endswith(StringRef(bundleTrailer, magicSize)))
+  {
+    return malformed("missing header or trailer");
+  }
+
+  StringRef graphFormat = bundle.substr(magicSize, magicSize);
+  graphFormat = graphFormat.take_until([](char c) { return c == '\0'; });
+  if (graphFormat.empty())
+  {
+    return malformed("missing graph format");
+  }
+
+  const char *trailer = bundle.end() - trailerSize;
+  uint64_t indexOffset = support::endian::read64le(trailer);
+  uint64_t entryCount = support::endian::read64le(trailer + sizeof(uint64_t));
+
+  uint64_t indexEnd = bundle.size() - trailerSize;
+  if (indexOffset < headerSize || indexOffset > indexEnd || entryCount != (indexEnd - indexOffset) / indexEntrySize ||
+      (indexEnd - indexOffset) % indexEntrySize != 0)
+  {
+    return malformed("index out of bounds");
+  }
+
+  std::string extension = ("." + graphFormat).str();
+  return std::unique_ptr<GraphBundle>(new GraphBundle(std::move(*bundleBuffer), std::move(extension), indexOffset, entryCount));
+}
+
+
+
+ssa2dot::GraphBundle::GraphBundle(std::unique_ptr<MemoryBuffer> bundleBuffer, std::string extension, uint64_t indexOffset, uint64_t entryCount)
+  : bundleBuffer(std::move(bundleBuffer)), extension(std::move(extension)), indexOffset(indexOffset), entryCount(entryCount)
+{
+}
+
+
+
+StringRef ssa2dot::GraphBundle::graphExtension() const
+{
+  return extension;
+}
+
+
+
+ssa2dot::GraphBundle::~GraphBundle() = default;
+
+
+
+Expected<StringRef> ssa2dot::GraphBundle::lookup(StringRef functionName) const
+{
+  StringRef bundle = bundleBuffer->getBuffer();
+  const char *indexStart = bundle.data() + indexOffset;
+
+  // Slice of the bundle, empty if it is out of bounds.
+  auto slice = [&bundle](uint64_t offset, uint64_t size)
+  {
+    if (offset > bundle.size() || size > bundle.size() - offset)
+    {
+      return std::optional<StringRef>();
+    }
+    return std::optional<StringRef>(bundle.substr(offset, size));
+  };
+
+  auto corrupt = [this]()
+  {
+    return createFileError(bundleBuffer->getBufferIdentifier(),
+                           createStringError(inconvertibleErrorCode(), "corrupt graph bundle index"));
+  };
+
+  uint64_t low = 0;
+  uint64_t high = entryCount;
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    const char *entry = indexStart + middle * indexEntrySize;
+
+    std::optional<StringRef> entryName = slice(support::endian::read64le(entry + 2 * sizeof(uint64_t)),
+                                               support::endian::read64le(entry + 3 * sizeof(uint64_t)));
+    if (!entryName)
+    {
+      return corrupt();
+    }
+
+    int order = entryName->compare(functionName);
+    if (order < 0)
+    {
+      low = middle + 1;
+    }
+    else if (order > 0)
+    {
+      high = middle;
+    }
+    else
+    {
+      std::optional<StringRef> graph = slice(support::endian::read64le(entry), support::endian::read64le(entry + sizeof(uint64_t)));
+      if (!graph)
+      {
+        return corrupt();
+      }
+      return *graph;
+    }
+  }
+
+  return createStringError(inconvertibleErrorCode(), "%s has no graph of %s",
+                           bundleBuffer->getBufferIdentifier().str().c_str(), functionName.str().c_str());
+}
@@ -0,0 +1,361 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotCache.cpp - Skip rewriting unchanged graphs ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Every .dot file written by the passes gets an entry in the cache directory
+// holding the hash of what the graph was rendered from. As long as that hash
+// does not change, the graph is neither rendered nor written again.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "ssa2dot"
+
+STATISTIC(NumGraphCacheHits, "Number of graphs skipped because their content hash was unchanged");
+STATISTIC(NumGraphCacheMisses, "Number of graphs rendered because their content hash changed or was missing");
+
+static cl::opt<std::string> cacheDirectory("ssa2dot-cache-dir",
+    cl::desc("Directory of content hashes used to skip rewriting unchanged .dot files"),
+    cl::init(""));
+
+// Bumped whenever the rendering changes, so that old cache entries miss.
+static const char *graphFormatVersion = "ssa2dot-4";
+
+
+
+// Feeds everything written to it into an MD5 hash, without keeping the text.
+class MD5Stream : public raw_ostream
+{
+public:
+  explicit MD5Stream(MD5 &hash) : hash(hash)
+  {
+    SetBufferSize(4096);
+  }
+
+  ~MD5Stream() override
+  {
+    flush();
+  }
+
+private:
+  MD5 &hash;
+  uint64_t bytesWritten = 0;
+
+  void write_impl(const char *data, size_t size) override
+  {
+    hash.update(StringRef(data, size));
+    bytesWritten += size;
+  }
+
+  uint64_t current_pos() const override
+  {
+    return bytesWritten;
+  }
+};
+
+
+
+// Path of the cache entry that belongs to a .dot file.
+static SmallString<128> cacheEntryPath(StringRef fileName)
+{
+  SmallString<128> absoluteName(fileName);
+  sys::fs::make_absolute(absoluteName);
+
+  MD5 pathHash;
+  pathHash.update(absoluteName);
+  MD5::MD5Result entryName;
+  pathHash.final(entryName);
+
+  SmallString<128> entryPath(cacheDirectory);
+  sys::path::append(entryPath, entryName.digest());
+  return entryPath;
+}
+
+
+
+// Writes how a value is referred to in a label: local values by name or
+// slot number, globals by name, integers by value. Other constants are rare
+// enough to be printed.
+static void hashOperand(raw_ostream &hashStream, const Value *operand, ModuleSlotTracker &slotTracker)
+{
+  if (isa<Argument>(operand) || isa<Instruction>(operand) || isa<BasicBlock>(operand))
+  {
+    if (operand->hasName())
+    {
+      hashStream << '%' << operand->getName();
+    }
+    else
+    {
+      hashStream << '%' << slotTracker.getLocalSlot(operand);
+    }
+  }
+  else if (const GlobalValue *global = dyn_cast<GlobalValue>(operand))
+  {
+    hashStream << '@' << global->getName();
+  }
+  else if (const ConstantInt *integer = dyn_cast<ConstantInt>(operand))
+  {
+    hashStream << integer->getValue();
+  }
+  else
+  {
+    operand->printAsOperand(hashStream, false, slotTracker);
+  }
+  hashStream << ' ';
+}
+
+
+
+// Hashes the parts of an instruction its label shows, without printing the
+// instruction: its name, opcode, flags, types, operands and the details
+// specific to the common instructions. Metadata attachments are hashed by
+// kind only, their numbers change with edits elsewhere in the module.
+static void hashInstruction(raw_ostream &hashStream, const Instruction &inst, ModuleSlotTracker &slotTracker)
+{
+  if (!inst.getType()->isVoidTy())
+  {
+    hashOperand(hashStream, &inst, slotTracker);
+  }
+  hashStream << inst.getOpcodeName() << ' ' << inst.getRawSubclassOptionalData() << ' ';
+  inst.getType()->print(hashStream);
+
+  if (const CmpInst *compare = dyn_cast<CmpInst>(&inst))
+  {
+    hashStream << ' ' << compare->getPredicate();
+  }
+  else if (const LoadInst *load = dyn_cast<LoadInst>(&inst))
+  {
+    hashStream << ' ' << load->getAlign().value() << ' ' << load->isVolatile() << ' ' << static_cast<int>(load->getOrdering());
+  }
+  else if (const StoreInst *store = dyn_cast<StoreInst>(&inst))
+  {
+    hashStream << ' ' << store->getAlign().value() << ' ' << store->isVolatile() << ' ' << static_cast<int>(store->getOrdering());
+  }
+  else if (const AllocaInst *alloca = dyn_cast<AllocaInst>(&inst))
+  {
+    hashStream << ' ' << alloca->getAlign().value() << ' ';
+    alloca->getAllocatedType()->print(hashStream);
+  }
+  else if (const GetElementPtrInst *elementPointer = dyn_cast<GetElementPtrInst>(&inst))
+  {
+    hashStream << ' ';
+    elementPointer->getSourceElementType()->print(hashStream);
+  }
+  else if (const CallBase *call = dyn_cast<CallBase>(&inst))
+  {
+    hashStream << ' ' << call->getCallingConv() << ' ';
+    if (const CallInst *callInst = dyn_cast<CallInst>(call))
+    {
+      hashStream << callInst->getTailCallKind() << ' ';
+    }
+    call->getFunctionType()->print(hashStream);
+    AttributeList attributes = call->getAttributes();
+    for (unsigned int index : attributes.indexes())
+    {
+      hashStream << ' ' << attributes.getAsString(index);
+    }
+  }
+  else if (const ShuffleVectorInst *shuffle = dyn_cast<ShuffleVectorInst>(&inst))
+  {
+    for (int maskElement : shuffle->getShuffleMask())
+    {
+      hashStream << ' ' << maskElement;
+    }
+  }
+  else if (const ExtractValueInst *extract = dyn_cast<ExtractValueInst>(&inst))
+  {
+    for (unsigned int index : extract->indices())
+    {
+      hashStream << ' ' << index;
+    }
+  }
+  else if (const InsertValueInst *insert = dyn_cast<InsertValueInst>(&inst))
+  {
+    for (unsigned int index : insert->indices())
+    {
+      hashStream << ' ' << index;
+    }
+  }
+  else if (const PHINode *phi = dyn_cast<PHINode>(&inst))
+  {
+    hashStream << ' ';
+    for (const BasicBlock *incomingBlock : phi->blocks())
+    {
+      hashOperand(hashStream, incomingBlock, slotTracker);
+    }
+  }
+  hashStream << '\n';
+
+  for (const Value *operand : inst.operand_values())
+  {
+    operand->getType()->print(hashStream);
+    hashStream << ' ';
+    hashOperand(hashStream, operand, slotTracker);
+  }
+
+  SmallVector<std::pair<unsigned int, MDNode*>, 4> attachments;
+  inst.getAllMetadataOtherThanDebugLoc(attachments);
+  for (const std::pair<unsigned int, MDNode*> &attachment : attachments)
+  {
+    hashStream << '!' << attachment.first << ' ';
+  }
+  hashStream << '\n';
+}
+
+
+
+// The instructions are hashed by their structure rather than by printing
+// their labels, which is most of the cost of a graph. Debug locations are
+// left out like in the labels, so that locations renumbered by edits
+// elsewhere in the module do not change the hash.
+void ssa2dot::hashFunctionStructure(raw_ostream &hashStream, const Function &F)
+{
+  hashStream << F.getName() << '\n';
+
+  ModuleSlotTracker slotTracker(F.getParent(), false);
+  slotTracker.incorporateFunction(F);
+
+  for (const Argument &arg : F.args())
+  {
+    arg.getType()->print(hashStream);
+    hashStream << ' ';
+    hashOperand(hashStream, &arg, slotTracker);
+    hashStream << F.getAttributes().getParamAttrs(arg.getArgNo()).getAsString() << '\n';
+  }
+
+  for (const BasicBlock &BB : F)
+  {
+    hashStream << BB.getName() << ":\n";
+    for (const Instruction &inst : BB)
+    {
+      hashInstruction(hashStream, inst, slotTracker);
+    }
+  }
+}
+
+
+
+// Hashes exactly what the graph of F is made of: its structure, the heat and,
+// with -ssa2dot-source, the source cluster, which covers the lines when they
+// are shown.
+MD5::MD5Result ssa2dot::hashFunctionContent(const Function &F, StringRef nodePrefix, const FunctionHeat *heat, SourceIndexCache *sourceIndexes)
+{
+  MD5 hash;
+
+  {
+    MD5Stream hashStream(hash);
+    hashStream << graphFormatVersion << '\n';
+    printRenderOptions(hashStream);
+    hashStream << nodePrefix << '\n';
+    hashStream << FunctionComparator::functionHash(const_cast<Function&>(F)) << '\n';
+    hashFunctionStructure(hashStream, F);
+
+    // Heat changes colors and collapses blocks without any change to F.
+    if (heat)
+    {
+      for (const BasicBlock &BB : F)
+      {
+        hashStream << heat->blockHeat.lookup(&BB) << (heat->coldBlocks.contains(&BB) ? " cold" : "");
+        for (unsigned int i = 0, num = BB.getTerminator() ? BB.getTerminator()->getNumSuccessors() : 0; i < num; ++i)
+        {
+          hashStream << ' ' << heat->edgeHeat.lookup({&BB, i});
+        }
+        hashStream << '\n';
+      }
+    }
+
+    if (isSourceClusterEnabled())
+    {
+      std::unique_ptr<GraphEmitter> emitter = createGraphEmitter(hashStream);
+      emitter->beginFunction(F.getName(), nodePrefix);
+      GraphMetadata metaData = mapInstructionToNodeIdentifier(F, nodePrefix);
+      metaData.heat = heat;
+      metaData.sourceIndexes = sourceIndexes;
+      renderSourceCluster(F, metaData, *emitter);
+      emitter->endFunction();
+    }
+  }
+
+  MD5::MD5Result contentHash;
+  hash.final(contentHash);
+  return contentHash;
+}
+
+
+
+bool ssa2dot::isGraphCacheEnabled()
+{
+  return !cacheDirectory.empty();
+}
+
+
+
+// True if fileName exists and was written from content with the given hash.
+// A symbolic link left by -ssa2dot-dedup shows the graph of another function
+// and is never up to date, even if the function was written there before.
+bool ssa2dot::isGraphUpToDate(StringRef fileName, const MD5::MD5Result &contentHash)
+{
+  if (!isGraphCacheEnabled())
+  {
+    return false;
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> cacheEntry = MemoryBuffer::getFile(cacheEntryPath(fileName));
+
+  if (cacheEntry && (*cacheEntry)->getBuffer() == contentHash.digest().str() && sys::fs::exists(fileName) && !sys::fs::is_symlink_file(fileName))
+  {
+    NumGraphCacheHits++;
+    return true;
+  }
+
+  NumGraphCacheMisses++;
+  return false;
+}
+
+
+
+// Records the hash of a freshly written .dot file.
+void ssa2dot::recordGraph(StringRef fileName, const MD5::MD5Result &contentHash)
+{
+  if (!isGraphCacheEnabled())
+  {
+    return;
+  }
+
+  std::error_code errorCode = sys::fs::create_directories(cacheDirectory);
+  if (!errorCode)
+  {
+    raw_fd_ostream cacheEntry(cacheEntryPath(fileName), errorCode, sys::fs::OF_None);
+    if (!errorCode)
+    {
+      cacheEntry << contentHash.digest();
+    }
+  }
+
+  if (errorCode)
+  {
+    errs() << "Could not update the graph cache in " << cacheDirectory << ": " << errorCode.message() << "\n";
+  }
+}
@@ -0,0 +1,236 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotChanged.cpp - Graphs of the functions a pass changed -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// SSAtoDotChangedPrinter follows a pass pipeline through the pass
+// instrumentation. Before and after every pass, the functions of the IR unit
+// the pass runs on are hashed, and only the ones whose hash differs from
+// that of their last graph are rendered again. Hashing reads the IR once
+// without printing it, so a pass that leaves a function alone costs about as
+// much as walking the function's instructions.
+//
+// The hash is the structural one of the graph cache, hashFunctionStructure,
+// with a cheaper hasher than MD5. It covers what the labels show apart from
+// debug locations, so a pass that only raises an alignment or relaxes an
+// atomic ordering produces a graph too, and rewiring an instruction to
+// another operand counts as a change.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/Analysis/LazyCallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+
+using namespace llvm;
+
+static cl::opt<bool> printChanged("ssa2dot-print-changed",
+    cl::desc("Write a numbered graph of a function before the pipeline and after every pass that changed it"),
+    cl::init(false));
+
+std::string outputBaseName(std::string sourceName);
+uint64_t functionHash(const Function &F);
+std::string passFileName(StringRef passName);
+
+// The IR unit a pass runs on, or null if it is of another kind. Casting a
+// pointer to Any only returns null for other types since LLVM 16.
+template <typename IRUnitT> const IRUnitT *unwrapIR(Any &IR)
+{
+#if LLVM_VERSION_MAJOR >= 16
+  const IRUnitT *const *unit = any_cast<const IRUnitT*>(&IR);
+  return unit ? *unit : nullptr;
+#else
+  return any_isa<const IRUnitT*>(IR) ? any_cast<const IRUnitT*>(IR) : nullptr;
+#endif
+}
+
+
+
+bool ssa2dot::isPrintChangedEnabled()
+{
+  return printChanged;
+}
+
+
+
+// Combines the hashes of everything written to it, without keeping the
+// text. The buffer size is fixed, so the same text always hashes the same.
+class CodeHashStream : public raw_ostream
+{
+public:
+  CodeHashStream()
+  {
+    SetBufferSize(4096);
+  }
+
+  uint64_t hash()
+  {
+    flush();
+    return combinedHash;
+  }
+
+private:
+  hash_code combinedHash = hash_value(0);
+  uint64_t bytesWritten = 0;
+
+  void write_impl(const char *data, size_t size) override
+  {
+    combinedHash = hash_combine(combinedHash, StringRef(data, size));
+    bytesWritten += size;
+  }
+
+  uint64_t current_pos() const override
+  {
+    return bytesWritten;
+  }
+};
+
+
+
+uint64_t functionHash(const Function &F)
+{
+  CodeHashStream hashStream;
+  ssa2dot::hashFunctionStructure(hashStream, F);
+  return hashStream.hash();
+}
+
+
+
+// The pass name as part of a file name, pass class names may contain
+// template arguments.
+std::string passFileName(StringRef passName)
+{
+  std::string fileName = passName.str();
+  for (char &c : fileName)
+  {
+    if (!isAlnum(c) && c != '-' && c != '_')
+    {
+      c = '_';
+    }
+  }
+  return fileName;
+}
+
+
+
+void SSAtoDotChangedPrinter::registerCallbacks(PassInstrumentationCallbacks &PIC)
+{
+  if (!printChanged)
+  {
+    return;
+  }
+
+  PIC.registerBeforeNonSkippedPassCallback([this](StringRef passID, Any IR)
+  {
+    writeChangedGraphs(IR, passID, true);
+  });
+
+  PIC.registerAfterPassCallback([this, &PIC](StringRef passID, Any IR, const PreservedAnalyses &)
+  {
+    // The pipeline name of the pass, e.g. instcombine, where it is known.
+    StringRef passName = PIC.getPassNameForClassName(passID);
+    writeChangedGraphs(IR, passName.empty() ? passID : passName, false);
+  });
+}
+
+
+
+// Before a pass, only the functions without any graph yet are written, as
+// the state the pipeline started from. After it, every function whose hash
+// changed.
+void SSAtoDotChangedPrinter::writeChangedGraphs(Any IR, StringRef passName, bool beforePass)
+{
+  SmallVector<const Function*, 8> functions;
+  const Module *M = nullptr;
+
+  if (const Module *module = unwrapIR<Module>(IR))
+  {
+    M = module;
+    for (const Function &F : *module)
+    {
+      functions.push_back(&F);
+    }
+  }
+  else if (const Function *function = unwrapIR<Function>(IR))
+  {
+    functions.push_back(function);
+  }
+  else if (const LazyCallGraph::SCC *scc = unwrapIR<LazyCallGraph::SCC>(IR))
+  {
+    for (const LazyCallGraph::Node &node : *scc)
+    {
+      functions.push_back(&node.getFunction());
+    }
+  }
+  else if (const Loop *loop = unwrapIR<Loop>(IR))
+  {
+    functions.push_back(loop->getHeader()->getParent());
+  }
+
+  if (functions.empty())
+  {
+    return;
+  }
+  if (!M)
+  {
+    M = functions.front()->getParent();
+  }
+
+  // As in SSAtoDot, the selection is made once per module and kept by name.
+  // Functions that passes create later are not part of it, functions they
+  // delete are no longer found.
+  if (selectionModule != M->getModuleIdentifier())
+  {
+    selectedFunctions = ssa2dot::selectFunctionNames(*M);
+    selectionModule = M->getModuleIdentifier();
+    writtenHashes.clear();
+    sourceIndexes = std::make_shared<ssa2dot::SourceIndexCache>();
+  }
+
+  for (const Function *F : functions)
+  {
+    if (!selectedFunctions.contains(F->getName()) || F->isDeclaration())
+    {
+      continue;
+    }
+
+    auto writtenHash = writtenHashes.find(F->getName());
+    if (beforePass && writtenHash != writtenHashes.end())
+    {
+      continue;
+    }
+
+    uint64_t hash = functionHash(*F);
+    if (writtenHash != writtenHashes.end() && writtenHash->second == hash)
+    {
+      continue;
+    }
+    writtenHashes[F->getName()] = hash;
+
+    if (!graphWriter && ssa2dot::writeQueueLimit() != 0)
+    {
+      graphWriter = std::make_shared<ssa2dot::AsyncGraphWriter>(ssa2dot::writeQueueLimit());
+    }
+
+    std::string fileName;
+    raw_string_ostream fileNameStream(fileName);
+    fileNameStream << outputBaseName(M->getSourceFileName()) << "_" << F->getName() << "." << format("%04u", graphNumber++) << "."
+                   << (beforePass ? "input" : passFileName(passName)) << ssa2dot::graphFileExtension();
+    fileNameStream.flush();
+
+    ssa2dot::writeFunctionGraph(*F, fileName, graphWriter.get(), nullptr, sourceIndexes.get());
+  }
+}
@@ -0,0 +1,240 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotDedup.cpp - Shared graphs of identical functions -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Template-heavy C++ yields many linkonce_odr instantiations with the same
+// body. With -ssa2dot-dedup, the selected functions of a module are grouped
+// the way MergeFunctions does it: by the hash of FunctionComparator, and
+// within a hash by a full comparison. On top of that, the names of
+// arguments, blocks and values, and with -ssa2dot-source the source lines,
+// have to match, so that the graphs only differ in the function name.
+//
+// The first function of a group in module order is rendered, the others
+// share its graph: their files are symbolic links to its file and their
+// bundle entries point at its graph. The function pass only knows the
+// functions it rendered so far and compares each function against them when
+// it gets to it. Module graphs are not deduplicated.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "ssa2dot"
+
+STATISTIC(NumFunctionsDeduplicated, "Number of functions sharing the graph of an identical one");
+
+static cl::opt<bool> deduplicate("ssa2dot-dedup",
+    cl::desc("Render structurally identical functions once, the others link to the shared graph"),
+    cl::init(false));
+
+std::string functionFileName(const Function &F);
+bool haveSameLabels(const Function &left, const Function &right);
+bool linkGraphFile(const std::string &fileName, const std::string &targetFileName);
+
+
+
+bool ssa2dot::isDeduplicationEnabled()
+{
+  return deduplicate;
+}
+
+
+
+DenseMap<const Function*, const Function*> ssa2dot::findDuplicateFunctions(const Module &M, const DenseSet<const Function*> &selectedFunctions)
+{
+  DenseMap<const Function*, const Function*> duplicates;
+
+  GlobalNumberState globalNumbers;
+  DenseMap<FunctionComparator::FunctionHash, SmallVector<const Function*, 1>> representatives;
+
+  for (const Function &F : M)
+  {
+    if (!selectedFunctions.contains(&F))
+    {
+      continue;
+    }
+
+    // The hash only reads the function.
+    SmallVector<const Function*, 1> &candidates = representatives[FunctionComparator::functionHash(const_cast<Function&>(F))];
+
+    auto representative = llvm::find_if(candidates, [&F, &globalNumbers](const Function *candidate)
+    {
+      return haveSameLabels(*candidate, F) && FunctionComparator(candidate, &F, &globalNumbers).compare() == 0;
+    });
+
+    if (representative != candidates.end())
+    {
+      duplicates[&F] = *representative;
+      NumFunctionsDeduplicated++;
+    }
+    else
+    {
+      candidates.push_back(&F);
+    }
+  }
+
+  return duplicates;
+}
+
+
+
+// The functions are looked up by name, a function rendered earlier may have
+// been deleted since or replaced by another one of the same name, and are
+// compared in full again, it may have been changed since.
+const Function *ssa2dot::findRenderedDuplicate(const Function &F, RenderedFunctions &renderedFunctions)
+{
+  // The hash only reads the function.
+  SmallVector<std::string, 1> &candidates = renderedFunctions[FunctionComparator::functionHash(const_cast<Function&>(F))];
+
+  GlobalNumberState globalNumbers;
+  for (const std::string &candidateName : candidates)
+  {
+    const Function *candidate = F.getParent()->getFunction(candidateName);
+    if (candidate && candidate != &F && !candidate->isDeclaration() && haveSameLabels(*candidate, F) && FunctionComparator(candidate, &F, &globalNumbers).compare() == 0)
+    {
+      NumFunctionsDeduplicated++;
+      return candidate;
+    }
+  }
+
+  if (!llvm::is_contained(candidates, F.getName()))
+  {
+    candidates.push_back(F.getName().str());
+  }
+  return nullptr;
+}
+
+
+
+// True if the names, and with -ssa2dot-source the source lines, of the two
+// functions match, apart from the function names. Their shapes may still
+// differ, the comparison stops at the first mismatch.
+bool haveSameLabels(const Function &left, const Function &right)
+{
+  if (left.arg_size() != right.arg_size() || left.size() != right.size())
+  {
+    return false;
+  }
+
+  for (auto [leftArg, rightArg] : zip(left.args(), right.args()))
+  {
+    if (leftArg.getName() != rightArg.getName())
+    {
+      return false;
+    }
+  }
+
+  bool compareLines = ssa2dot::isSourceClusterEnabled();
+
+  for (auto [leftBlock, rightBlock] : zip(left, right))
+  {
+    if (leftBlock.getName() != rightBlock.getName() || leftBlock.size() != rightBlock.size())
+    {
+      return false;
+    }
+
+    for (auto [leftInst, rightInst] : zip(leftBlock, rightBlock))
+    {
+      if (leftInst.getName() != rightInst.getName())
+      {
+        return false;
+      }
+
+      if (compareLines)
+      {
+        const DebugLoc &leftLocation = leftInst.getDebugLoc();
+        const DebugLoc &rightLocation = rightInst.getDebugLoc();
+        if (bool(leftLocation) != bool(rightLocation) || (leftLocation && leftLocation.getLine() != rightLocation.getLine()))
+        {
+          return false;
+        }
+      }
+    }
+  }
+
+  return !compareLines || left.getSubprogram()->getLine() == right.getSubprogram()->getLine();
+}
+
+
+
+// The representative is structurally identical, so it has the same pages.
+bool ssa2dot::linkFunctionGraph(const Function &F, const Function &representative)
+{
+  std::string fileName = functionFileName(F);
+  std::string targetFileName = functionFileName(representative);
+
+  std::vector<unsigned int> pageStarts = paginateFunction(representative);
+  if (pageStarts.empty())
+  {
+    return linkGraphFile(fileName, targetFileName);
+  }
+
+  for (unsigned int pageNumber = 0; pageNumber < pageStarts.size(); ++pageNumber)
+  {
+    if (!linkGraphFile(pageFileName(fileName, pageNumber), pageFileName(targetFileName, pageNumber)))
+    {
+      // The pages are rendered instead, none of them stays a link.
+      for (unsigned int linkedPage = 0; linkedPage < pageNumber; ++linkedPage)
+      {
+        sys::fs::remove(pageFileName(fileName, linkedPage));
+      }
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+// Replaces the file with a symbolic link to the target in the same directory.
+bool linkGraphFile(const std::string &fileName, const std::string &targetFileName)
+{
+  sys::fs::remove(fileName);
+
+  std::error_code errorCode = sys::fs::create_link(sys::path::filename(targetFileName), fileName);
+  if (errorCode)
+  {
+    errs() << "Could not link " << fileName << " to " << targetFileName << ": " << errorCode.message() << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+
+
+bool ssa2dot::addBundleAliases(GraphBundleWriter &bundleWriter, const Function &F, const Function &representative)
+{
+  std::vector<unsigned int> pageStarts = paginateFunction(representative);
+  if (pageStarts.empty())
+  {
+    return bundleWriter.addAlias(F.getName(), representative.getName());
+  }
+
+  std::vector<std::pair<std::string, std::string>> pageAliases;
+  for (unsigned int pageNumber = 0; pageNumber < pageStarts.size(); ++pageNumber)
+  {
+    pageAliases.push_back({pageFileName(F.getName(), pageNumber), pageFileName(representative.getName(), pageNumber)});
+  }
+
+  return bundleWriter.addAliases(pageAliases);
+}
@@ -0,0 +1,596 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotEmitter.cpp - DOT and JSON graph backends ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The IR walk in ssa2dot.cpp describes a graph to a GraphEmitter, the
+// backend of -ssa2dot-format decides how it is written:
+//
+//   dot     Graphviz, the default. Nodes and edges are written as they come.
+//   json    One JSON object per function and line, with its nodes, clusters
+//           and edges. The edges follow the nodes, they are held back until
+//           the function ends.
+//   binary  Fixed-size records with a string table, see ssa2dotBinaryGraph.cpp.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <optional>
+
+using namespace llvm;
+using ssa2dot::ClusterKind;
+using ssa2dot::EdgeKind;
+using ssa2dot::GraphNode;
+using ssa2dot::LabelWriter;
+using ssa2dot::NodeKind;
+
+enum class GraphFormat { DOT, JSON, Binary };
+
+static cl::opt<GraphFormat> graphFormat("ssa2dot-format",
+    cl::desc("Backend the graphs are written with"),
+    cl::values(clEnumValN(GraphFormat::DOT, "dot", "Graphviz DOT (default)"),
+               clEnumValN(GraphFormat::JSON, "json", "One JSON object per function and line"),
+               clEnumValN(GraphFormat::Binary, "binary", "Fixed-size records with a string table, readable in place")),
+    cl::init(GraphFormat::DOT));
+
+std::unique_ptr<ssa2dot::GraphEmitter> createBinaryGraphEmitter(raw_ostream &graphStream);
+void writeNodeName(raw_ostream &stream, StringRef nodePrefix, const GraphNode &node);
+void writeClusterName(raw_ostream &stream, StringRef nodePrefix, ClusterKind kind, unsigned int number, StringRef label);
+void writeHeatColor(raw_ostream &stream, double heat, double saturation);
+
+
+
+ssa2dot::GraphEmitter::~GraphEmitter() = default;
+
+
+
+// Node names, e.g. Instruction100_3 for the fourth instruction of the first
+// block, Block100 for the block itself, Line42 for a source line or Stub100
+// for the block on another page.
+void writeNodeName(raw_ostream &stream, StringRef nodePrefix, const GraphNode &node)
+{
+  stream << nodePrefix;
+
+  switch (node.kind)
+  {
+    case NodeKind::FunctionName:
+      stream << "FNAME";
+      return;
+    case NodeKind::Arguments:
+      stream << "ARGUMENTS";
+      return;
+    case NodeKind::Instruction:
+      stream << "Instruction" << node.first << "_" << node.second;
+      return;
+    case NodeKind::Block:
+      stream << "Block" << node.first;
+      return;
+    case NodeKind::UseSummary:
+      stream << "Uses" << node.first << "_" << node.second;
+      return;
+    case NodeKind::ArgumentUseSummary:
+      stream << "ArgumentUses" << node.first;
+      return;
+    case NodeKind::SourceLine:
+      stream << "Line" << node.first;
+      return;
+    case NodeKind::PageStub:
+      stream << "Stub" << node.first;
+      return;
+  }
+  llvm_unreachable("Unknown node kind");
+}
+
+
+
+// Cluster names, e.g. cluster_LLVM_1 for the function and cluster_100 for its
+// first block.
+void writeClusterName(raw_ostream &stream, StringRef nodePrefix, ClusterKind kind, unsigned int number, StringRef label)
+{
+  stream << "cluster_" << nodePrefix;
+  if (kind == ClusterKind::Block)
+  {
+    stream << number;
+    return;
+  }
+  stream << label << "_" << number;
+}
+
+
+
+// Quoted HSV color of a heat, from blue for cold to red for hot. Fills are
+// paler than lines, saturation scales with the heat.
+void writeHeatColor(raw_ostream &stream, double heat, double saturation)
+{
+  stream << format("\"%.3f %.3f 1.000\"", 0.6 * (1 - heat), saturation);
+}
+
+
+
+class DotEmitter : public ssa2dot::GraphEmitter
+{
+public:
+  explicit DotEmitter(raw_ostream &graphStream) : graphStream(graphStream)
+  {
+  }
+
+  void beginGraph() override
+  {
+    graphStream << "digraph G {     node [shape=box, style=filled, color=lightblue]; \n";
+  }
+
+  void endGraph() override
+  {
+    graphStream << "\n }";
+  }
+
+  void beginFunction(StringRef, StringRef nodePrefix) override
+  {
+    this->nodePrefix = nodePrefix;
+  }
+
+  // Functions sharing a digraph start on a line of their own.
+  void endFunction() override
+  {
+    graphStream << "\n";
+  }
+
+  void beginCluster(ClusterKind kind, unsigned int number, StringRef label) override
+  {
+    if (kind != ClusterKind::Function)
+    {
+      graphStream << "\n ";
+    }
+    graphStream << "subgraph ";
+    writeClusterName(graphStream, nodePrefix, kind, number, label);
+    graphStream << " {label = \"";
+    ssa2dot::writeEscaped(graphStream, label);
+    graphStream << "\";";
+
+    if (pendingHeat)
+    {
+      graphStream << " style=filled; fillcolor=";
+      writeHeatColor(graphStream, *pendingHeat, 0.1 + 0.3 * *pendingHeat);
+      graphStream << ";";
+      pendingHeat.reset();
+    }
+
+    openClusters.push_back(kind);
+  }
+
+  void endCluster() override
+  {
+    // Block clusters are followed by the next block, the function cluster by
+    // the edges between them.
+    graphStream << (openClusters.back() == ClusterKind::Function ? "\n}" : "}\n");
+    openClusters.pop_back();
+  }
+
+  void node(const GraphNode &node, LabelWriter writeLabel, bool isReturn) override
+  {
+    writeNodeName(graphStream, nodePrefix, node);
+    graphStream << " [label = \"";
+    {
+      // The label is escaped on its way into the graph, it is not copied or
+      // scanned again.
+      ssa2dot::DotEscapingStream labelStream(graphStream);
+      writeLabel(labelStream);
+    }
+    graphStream << "\"";
+
+    switch (node.kind)
+    {
+      case NodeKind::Arguments:
+        graphStream << ", shape=ellipse, color=red";
+        break;
+      case NodeKind::Instruction:
+        if (isReturn)
+        {
+          graphStream << ", shape=ellipse, color=lightgreen";
+        }
+        break;
+      case NodeKind::UseSummary:
+      case NodeKind::ArgumentUseSummary:
+        graphStream << ", shape=note, color=lightgray";
+        break;
+      case NodeKind::SourceLine:
+        graphStream << ", color=lightyellow";
+        break;
+      case NodeKind::PageStub:
+        graphStream << ", shape=cds, color=orange";
+        break;
+      default:
+        break;
+    }
+
+    writeNodeHeat();
+    graphStream << "];";
+  }
+
+  // A record with the block name on top and one left-aligned row per
+  // instruction below, line breaks in the rows become \l.
+  void blockNode(const GraphNode &node, StringRef blockName, LabelWriter writeRows, bool isReturn) override
+  {
+    graphStream << "\n ";
+    writeNodeName(graphStream, nodePrefix, node);
+    graphStream << " [shape=record, label=\"{";
+    {
+      ssa2dot::DotEscapingStream recordStream(graphStream, ssa2dot::EscapeContext::Record);
+      recordStream << blockName;
+      recordStream.flush();
+      graphStream << "|";
+      writeRows(recordStream);
+    }
+    graphStream << "}\"";
+
+    if (isReturn)
+    {
+      graphStream << ", color=lightgreen";
+    }
+    writeNodeHeat();
+    graphStream << "];";
+  }
+
+  void edge(const GraphNode &from, const GraphNode &to, EdgeKind kind) override
+  {
+    graphStream << " ";
+    writeNodeName(graphStream, nodePrefix, from);
+    graphStream << "->";
+    writeNodeName(graphStream, nodePrefix, to);
+
+    // Hot edges are drawn thicker and pull their ends closer together.
+    if (pendingHeat)
+    {
+      graphStream << " [";
+      if (kind == EdgeKind::SwitchDefault)
+      {
+        graphStream << "label=\"default\", ";
+      }
+      graphStream << "color=";
+      writeHeatColor(graphStream, *pendingHeat, 0.4 + 0.6 * *pendingHeat);
+      graphStream << format(", penwidth=%.1f, weight=%u]; ", 1 + 4 * *pendingHeat, 1 + static_cast<unsigned int>(99 * *pendingHeat));
+      pendingHeat.reset();
+      return;
+    }
+
+    switch (kind)
+    {
+      case EdgeKind::Branch:
+        graphStream << " [color = red]";
+        break;
+      case EdgeKind::SwitchDefault:
+        graphStream << " [label=\"default\", color=red]";
+        break;
+      case EdgeKind::Invoke:
+        graphStream << " [color = blue]";
+        break;
+      case EdgeKind::DefUse:
+        // Def-use and source edges do not constrain the layout, which keeps
+        // following the control flow.
+        graphStream << " [style=dotted, color=darkgreen, constraint=false]";
+        break;
+      case EdgeKind::SourceLine:
+        graphStream << " [style=dashed, color=gray, constraint=false]";
+        break;
+      default:
+        break;
+    }
+
+    graphStream << "; ";
+  }
+
+  void heat(double heat) override
+  {
+    pendingHeat = heat;
+  }
+
+  // A second statement for the node, Graphviz merges its attributes.
+  void position(const GraphNode &node, double x, double y) override
+  {
+    graphStream << " ";
+    writeNodeName(graphStream, nodePrefix, node);
+    graphStream << " [pos=\"" << format("%.0f,%.0f", x, y) << "\"];";
+  }
+
+private:
+  raw_ostream &graphStream;
+  StringRef nodePrefix;
+  SmallVector<ClusterKind, 4> openClusters;
+  std::optional<double> pendingHeat;
+
+  // The fill follows the heat, the outline keeps marking returns.
+  void writeNodeHeat()
+  {
+    if (pendingHeat)
+    {
+      graphStream << ", fillcolor=";
+      writeHeatColor(graphStream, *pendingHeat, 0.2 + 0.5 * *pendingHeat);
+      pendingHeat.reset();
+    }
+  }
+};
+
+
+
+class JsonEmitter : public ssa2dot::GraphEmitter
+{
+public:
+  explicit JsonEmitter(raw_ostream &graphStream) : graphStream(graphStream)
+  {
+  }
+
+  void beginFunction(StringRef functionName, StringRef nodePrefix) override
+  {
+    this->nodePrefix = nodePrefix;
+
+    // A JSON stream writes a single value, one per function.
+    jsonStream.emplace(graphStream);
+    jsonStream->objectBegin();
+    jsonStream->attribute("function", jsonString(functionName));
+    jsonStream->attributeBegin("nodes");
+    jsonStream->arrayBegin();
+  }
+
+  void endFunction() override
+  {
+    jsonStream->arrayEnd();
+    jsonStream->attributeEnd();
+
+    jsonStream->attributeArray("clusters", [this]()
+    {
+      for (const ClusterEntry &cluster : clusters)
+      {
+        jsonStream->object([&]()
+        {
+          jsonStream->attribute("id", clusterName(cluster));
+          jsonStream->attribute("kind", kindName(cluster.kind));
+          jsonStream->attribute("label", jsonString(cluster.label));
+          if (cluster.parent != ssa2dot::noCluster)
+          {
+            jsonStream->attribute("parent", clusterName(clusters[cluster.parent]));
+          }
+          if (cluster.heat)
+          {
+            jsonStream->attribute("heat", *cluster.heat);
+          }
+        });
+      }
+    });
+
+    jsonStream->attributeArray("edges", [this]()
+    {
+      for (const EdgeEntry &edge : edges)
+      {
+        jsonStream->object([&]()
+        {
+          jsonStream->attribute("from", nodeName(edge.from));
+          jsonStream->attribute("to", nodeName(edge.to));
+          jsonStream->attribute("kind", kindName(edge.kind));
+          if (edge.heat)
+          {
+            jsonStream->attribute("heat", *edge.heat);
+          }
+        });
+      }
+    });
+
+    jsonStream->objectEnd();
+    jsonStream.reset();
+    graphStream << "\n";
+
+    clusters.clear();
+    edges.clear();
+  }
+
+  void beginCluster(ClusterKind kind, unsigned int number, StringRef label) override
+  {
+    uint32_t parent = openClusters.empty() ? ssa2dot::noCluster : openClusters.back();
+    openClusters.push_back(clusters.size());
+    clusters.push_back({kind, number, label.str(), parent, pendingHeat});
+    pendingHeat.reset();
+  }
+
+  void endCluster() override
+  {
+    openClusters.pop_back();
+  }
+
+  void node(const GraphNode &node, LabelWriter writeLabel, bool isReturn) override
+  {
+    jsonStream->object([&]()
+    {
+      writeNodeAttributes(node, isReturn);
+      jsonStream->attribute("label", labelText(writeLabel));
+    });
+  }
+
+  void blockNode(const GraphNode &node, StringRef blockName, LabelWriter writeRows, bool isReturn) override
+  {
+    jsonStream->object([&]()
+    {
+      writeNodeAttributes(node, isReturn);
+      jsonStream->attribute("name", jsonString(blockName));
+      jsonStream->attribute("label", labelText(writeRows));
+    });
+  }
+
+  void edge(const GraphNode &from, const GraphNode &to, EdgeKind kind) override
+  {
+    edges.push_back({from, to, kind, pendingHeat});
+    pendingHeat.reset();
+  }
+
+  void heat(double heat) override
+  {
+    pendingHeat = heat;
+  }
+
+private:
+  struct ClusterEntry
+  {
+    ClusterKind kind;
+    unsigned int number;
+    std::string label;
+    uint32_t parent;
+    std::optional<double> heat;
+  };
+
+  struct EdgeEntry
+  {
+    GraphNode from;
+    GraphNode to;
+    EdgeKind kind;
+    std::optional<double> heat;
+  };
+
+  raw_ostream &graphStream;
+  std::optional<json::OStream> jsonStream;
+  StringRef nodePrefix;
+  std::vector<ClusterEntry> clusters;
+  SmallVector<uint32_t, 4> openClusters;
+  std::vector<EdgeEntry> edges;
+  SmallString<256> labelBuffer;
+  std::optional<double> pendingHeat;
+
+  // JSON strings have to be UTF-8, names and labels are not necessarily.
+  static json::Value jsonString(StringRef text)
+  {
+    if (json::isUTF8(text))
+    {
+      return text;
+    }
+    return json::fixUTF8(text);
+  }
+
+  json::Value labelText(LabelWriter writeLabel)
+  {
+    labelBuffer.clear();
+    raw_svector_ostream labelStream(labelBuffer);
+    writeLabel(labelStream);
+    return jsonString(labelBuffer.str());
+  }
+
+  std::string nodeName(const GraphNode &node) const
+  {
+    std::string name;
+    raw_string_ostream nameStream(name);
+    writeNodeName(nameStream, nodePrefix, node);
+    return nameStream.str();
+  }
+
+  std::string clusterName(const ClusterEntry &cluster) const
+  {
+    std::string name;
+    raw_string_ostream nameStream(name);
+    writeClusterName(nameStream, nodePrefix, cluster.kind, cluster.number, cluster.label);
+    return nameStream.str();
+  }
+
+  void writeNodeAttributes(const GraphNode &node, bool isReturn)
+  {
+    jsonStream->attribute("id", nodeName(node));
+    jsonStream->attribute("kind", kindName(node.kind));
+    if (!openClusters.empty())
+    {
+      jsonStream->attribute("cluster", clusterName(clusters[openClusters.back()]));
+    }
+    if (isReturn)
+    {
+      jsonStream->attribute("return", true);
+    }
+    if (pendingHeat)
+    {
+      jsonStream->attribute("heat", *pendingHeat);
+      pendingHeat.reset();
+    }
+  }
+
+  static StringRef kindName(NodeKind kind)
+  {
+    switch (kind)
+    {
+      case NodeKind::FunctionName: return "functionName";
+      case NodeKind::Arguments: return "arguments";
+      case NodeKind::Instruction: return "instruction";
+      case NodeKind::Block: return "block";
+      case NodeKind::UseSummary: return "useSummary";
+      case NodeKind::ArgumentUseSummary: return "argumentUseSummary";
+      case NodeKind::SourceLine: return "sourceLine";
+      case NodeKind::PageStub: return "pageStub";
+    }
+    llvm_unreachable("Unknown node kind");
+  }
+
+  static StringRef kindName(EdgeKind kind)
+  {
+    switch (kind)
+    {
+      case EdgeKind::Entry: return "entry";
+      case EdgeKind::Sequence: return "sequence";
+      case EdgeKind::Branch: return "branch";
+      case EdgeKind::SwitchDefault: return "switchDefault";
+      case EdgeKind::SwitchCase: return "switchCase";
+      case EdgeKind::Invoke: return "invoke";
+      case EdgeKind::Successor: return "successor";
+      case EdgeKind::DefUse: return "defUse";
+      case EdgeKind::SourceLine: return "sourceLine";
+    }
+    llvm_unreachable("Unknown edge kind");
+  }
+
+  static StringRef kindName(ClusterKind kind)
+  {
+    switch (kind)
+    {
+      case ClusterKind::Function: return "function";
+      case ClusterKind::Block: return "block";
+      case ClusterKind::Source: return "source";
+    }
+    llvm_unreachable("Unknown cluster kind");
+  }
+};
+
+
+
+std::unique_ptr<ssa2dot::GraphEmitter> ssa2dot::createGraphEmitter(raw_ostream &graphStream)
+{
+  switch (graphFormat)
+  {
+    case GraphFormat::DOT:
+      return std::make_unique<DotEmitter>(graphStream);
+    case GraphFormat::JSON:
+      return std::make_unique<JsonEmitter>(graphStream);
+    case GraphFormat::Binary:
+      return createBinaryGraphEmitter(graphStream);
+  }
+  llvm_unreachable("Unknown graph format");
+}
+
+
+
+StringRef ssa2dot::graphFileExtension()
+{
+  switch (graphFormat)
+  {
+    case GraphFormat::DOT:
+      return ".dot";
+    case GraphFormat::JSON:
+      return ".jsonl";
+    case GraphFormat::Binary:
+      return ".ssagraph";
+  }
+  llvm_unreachable("Unknown graph format");
+}
@@ -0,0 +1,172 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotEscape.cpp - Escaping of DOT labels ------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Escapes text in a single pass while it is written into the graph. The text
+// is scanned eight bytes at a time for the characters that are special in the
+// given context, runs without any are written in one piece and only the
+// special characters themselves are replaced.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+using ssa2dot::EscapeContext;
+
+
+
+// Characters that have to be escaped, per context.
+static StringRef specialCharacters(EscapeContext context)
+{
+  switch (context)
+  {
+    case EscapeContext::Quoted:
+      return StringRef("\"\\\n\r", 4);
+    case EscapeContext::Record:
+      return StringRef("\"\\\n\r{}|<>", 9);
+  }
+  llvm_unreachable("Unknown escape context");
+}
+
+
+
+// What a special character is replaced with.
+static StringRef escapeSequence(char c, EscapeContext context)
+{
+  switch (c)
+  {
+    case '"': return "\\\"";
+    case '\\': return "\\\\";
+    case '{': return "\\{";
+    case '}': return "\\}";
+    case '|': return "\\|";
+    case '<': return "\\<";
+    case '>': return "\\>";
+    // Line breaks in records are left aligned, like the rows of a block. A
+    // carriage return breaks the line like a line feed does.
+    case '\n':
+    case '\r': return context == EscapeContext::Record ? "\\l" : "\\n";
+    default: return "";
+  }
+}
+
+
+
+// One lookup table per context, for finding the special character inside a
+// word that has one.
+struct EscapeTables
+{
+  bool isSpecial[2][256] = {};
+
+  EscapeTables()
+  {
+    for (EscapeContext context : {EscapeContext::Quoted, EscapeContext::Record})
+    {
+      for (char c : specialCharacters(context))
+      {
+        isSpecial[static_cast<int>(context)][static_cast<unsigned char>(c)] = true;
+      }
+    }
+  }
+};
+
+static const EscapeTables escapeTables;
+
+
+
+// True if any byte of the word is c, without looking at the bytes one by one.
+static bool wordContains(uint64_t word, char c)
+{
+  const uint64_t lowBits = 0x0101010101010101ULL;
+  const uint64_t highBits = 0x8080808080808080ULL;
+
+  uint64_t matches = word ^ (lowBits * static_cast<unsigned char>(c));
+  return ((matches - lowBits) & ~matches & highBits) != 0;
+}
+
+
+
+void ssa2dot::writeEscaped(raw_ostream &stream, StringRef text, EscapeContext context)
+{
+  const bool *isSpecial = escapeTables.isSpecial[static_cast<int>(context)];
+  StringRef specials = specialCharacters(context);
+
+  const char *data = text.data();
+  size_t size = text.size();
+  size_t runStart = 0;
+  size_t i = 0;
+
+  while (i < size)
+  {
+    // Skips whole words of clean text.
+    if (i + 8 <= size)
+    {
+      uint64_t word;
+      memcpy(&word, data + i, sizeof(word));
+
+      bool hasSpecial = false;
+      for (char c : specials)
+      {
+        hasSpecial |= wordContains(word, c);
+      }
+
+      if (!hasSpecial)
+      {
+        i += 8;
+        continue;
+      }
+    }
+
+    size_t wordEnd = std::min(i + 8, size);
+    for (; i < wordEnd; ++i)
+    {
+      if (!isSpecial[static_cast<unsigned char>(data[i])])
+      {
+        continue;
+      }
+
+      stream.write(data + runStart, i - runStart);
+      stream << escapeSequence(data[i], context);
+      runStart = i + 1;
+    }
+  }
+
+  stream.write(data + runStart, size - runStart);
+}
+
+
+
+ssa2dot::DotEscapingStream::DotEscapingStream(raw_ostream &outputStream, EscapeContext context)
+  : outputStream(outputStream), context(context)
+{
+  // Everything goes straight to write_impl and from there into the buffer of
+  // the output stream, the text is not copied into a buffer of its own.
+  SetUnbuffered();
+}
+
+
+
+void ssa2dot::DotEscapingStream::write_impl(const char *data, size_t size)
+{
+  writeEscaped(outputStream, StringRef(data, size), context);
+  bytesWritten += size;
+}
+
+
+
+uint64_t ssa2dot::DotEscapingStream::current_pos() const
+{
+  return bytesWritten;
+}
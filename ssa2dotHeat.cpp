@@ -0,0 +1,116 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotHeat.cpp - Block frequency heat of function graphs ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -ssa2dot-heat, the block clusters and branch edges of a graph are
+// colored and weighted by how often they run, so that the hot path stands
+// out. Block frequencies come from BlockFrequencyAnalysis, the frequency of
+// an edge is that of its block times the probability of the branch from
+// BranchProbabilityAnalysis. Both are estimates from the IR unless the
+// module carries profile data.
+//
+// Heat is relative to the hottest block of the function. Blocks whose heat
+// is below -ssa2dot-cold-threshold are collapsed into a single node each.
+//
+// The analyses are queried through the analysis manager of the pass, so a
+// pipeline that computed them already does not compute them again. Heat is
+// computed before rendering and only read while rendering, which may run on
+// several threads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+static cl::opt<bool> heatEnabled("ssa2dot-heat",
+    cl::desc("Color and weight blocks and branch edges by their estimated frequency"),
+    cl::init(false));
+
+static cl::opt<double> coldThreshold("ssa2dot-cold-threshold",
+    cl::desc("With -ssa2dot-heat, collapse blocks running less often than this fraction of the hottest block"),
+    cl::init(0.0));
+
+
+
+bool ssa2dot::isHeatEnabled()
+{
+  return heatEnabled;
+}
+
+
+
+ssa2dot::FunctionHeat ssa2dot::computeFunctionHeat(Function &F, FunctionAnalysisManager &FAM)
+{
+  FunctionHeat heat;
+  if (F.isDeclaration())
+  {
+    return heat;
+  }
+
+  BlockFrequencyInfo &blockFrequencies = FAM.getResult<BlockFrequencyAnalysis>(F);
+  BranchProbabilityInfo &branchProbabilities = FAM.getResult<BranchProbabilityAnalysis>(F);
+
+  uint64_t hottestFrequency = 1;
+  for (const BasicBlock &BB : F)
+  {
+    hottestFrequency = std::max(hottestFrequency, blockFrequencies.getBlockFreq(&BB).getFrequency());
+  }
+
+  heat.blockHeat.reserve(F.size());
+  for (const BasicBlock &BB : F)
+  {
+    double blockHeat = static_cast<double>(blockFrequencies.getBlockFreq(&BB).getFrequency()) / hottestFrequency;
+    heat.blockHeat[&BB] = blockHeat;
+    if (blockHeat < coldThreshold)
+    {
+      heat.coldBlocks.insert(&BB);
+    }
+
+    const Instruction *terminator = BB.getTerminator();
+    if (terminator == nullptr)
+    {
+      continue;
+    }
+    for (unsigned int i = 0, num = terminator->getNumSuccessors(); i < num; ++i)
+    {
+      BranchProbability probability = branchProbabilities.getEdgeProbability(&BB, i);
+      heat.edgeHeat[{&BB, i}] = blockHeat * probability.getNumerator() / probability.getDenominator();
+    }
+  }
+
+  return heat;
+}
+
+
+
+// Heat of the definitions passing -ssa2dot-filter, a superset of the ones
+// that get a graph. Computed up front on the calling thread, the analysis
+// manager is not thread-safe.
+ssa2dot::ModuleHeat ssa2dot::computeModuleHeat(Module &M, FunctionAnalysisManager &FAM)
+{
+  ModuleHeat heat;
+  for (Function &F : M)
+  {
+    if (!F.isDeclaration() && ssa2dot::isFunctionSelected(F))
+    {
+      heat[&F] = computeFunctionHeat(F, FAM);
+    }
+  }
+
+  return heat;
+}
@@ -0,0 +1,496 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotLayout.cpp - Built-in layered layout -----------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Lays out the graph of a function in layers, the way dot would, but from
+// the structure of the IR instead of the graph, so that Graphviz only has
+// to draw it (neato -n2). The steps are those of a Sugiyama layout:
+//
+//   1. Blocks are taken in reverse post-order. Edges to a block that comes
+//      earlier are the back edges of loops and are left out of the layering,
+//      which keeps the rest acyclic.
+//   2. Each block is ranked by the longest path from the entry block.
+//   3. The blocks of a rank are ordered by the barycenter of their
+//      neighbours, in a fixed number of sweeps down and up.
+//   4. Ranks are stacked top-down, as tall as their tallest block, and the
+//      blocks of a rank side by side, as wide as their widest label.
+//
+// All steps are linear in the number of blocks and edges, apart from sorting
+// the ranks, so the layout takes a bounded part of the rendering time. Long
+// edges are not split into chains of dummy nodes, they are drawn straight.
+//
+// Labels are measured while they are written, the positions are emitted at
+// the end of the function.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+
+using namespace llvm;
+using ssa2dot::ClusterKind;
+using ssa2dot::EdgeKind;
+using ssa2dot::GraphMetadata;
+using ssa2dot::GraphNode;
+using ssa2dot::LabelWriter;
+using ssa2dot::NodeKind;
+
+static cl::opt<bool> layoutEnabled("ssa2dot-layout",
+    cl::desc("Position the nodes of function graphs with a built-in layered layout, to be drawn with neato -n2"),
+    cl::init(false));
+
+// Sizes in points. A character is about as wide as in Graphviz' default
+// 14pt font, nodes are at least as large as its default node.
+static const double characterWidth = 7;
+static const double lineHeight = 18;
+static const double labelMargin = 18;
+static const double minimumWidth = 54;
+static const double minimumHeight = 36;
+static const double nodeGap = 18;
+static const double columnGap = 36;
+static const double rankGap = 54;
+
+static const unsigned int orderingSweeps = 4;
+
+
+
+// Passes a label on to the stream of the backend and measures its longest
+// line and its number of lines.
+class LabelMeasuringStream : public raw_ostream
+{
+public:
+  explicit LabelMeasuringStream(raw_ostream &outputStream) : outputStream(outputStream)
+  {
+    SetUnbuffered();
+  }
+
+  size_t longestLine() const { return std::max(longest, current); }
+  unsigned int lineCount() const { return lines + (current != 0 ? 1 : 0); }
+
+private:
+  raw_ostream &outputStream;
+  size_t longest = 0;
+  size_t current = 0;
+  unsigned int lines = 0;
+  uint64_t bytesWritten = 0;
+
+  void write_impl(const char *data, size_t size) override
+  {
+    outputStream.write(data, size);
+    bytesWritten += size;
+
+    StringRef text(data, size);
+    for (size_t newline = text.find('\n'); newline != StringRef::npos; newline = text.find('\n'))
+    {
+      longest = std::max(longest, current + newline);
+      current = 0;
+      lines++;
+      text = text.drop_front(newline + 1);
+    }
+    current += text.size();
+  }
+
+  uint64_t current_pos() const override
+  {
+    return bytesWritten;
+  }
+};
+
+
+
+class LayoutEmitter : public ssa2dot::GraphEmitter
+{
+public:
+  LayoutEmitter(const Function &F, const GraphMetadata &metaData, std::unique_ptr<GraphEmitter> emitter);
+
+  void beginGraph() override { emitter->beginGraph(); }
+  void endGraph() override { emitter->endGraph(); }
+
+  void beginFunction(StringRef functionName, StringRef nodePrefix) override
+  {
+    emitter->beginFunction(functionName, nodePrefix);
+  }
+
+  void endFunction() override
+  {
+    placeNodes();
+    emitter->endFunction();
+  }
+
+  void beginCluster(ClusterKind kind, unsigned int number, StringRef label) override
+  {
+    emitter->beginCluster(kind, number, label);
+  }
+
+  void endCluster() override { emitter->endCluster(); }
+
+  void node(const GraphNode &node, LabelWriter writeLabel, bool isReturn) override
+  {
+    PlacedNode &placedNode = nodes.emplace_back(PlacedNode{node});
+    emitter->node(node, [&placedNode, writeLabel](raw_ostream &labelStream)
+    {
+      LabelMeasuringStream measuringStream(labelStream);
+      writeLabel(measuringStream);
+      placedNode.measure(measuringStream.longestLine(), measuringStream.lineCount());
+    }, isReturn);
+  }
+
+  void blockNode(const GraphNode &node, StringRef blockName, LabelWriter writeRows, bool isReturn) override
+  {
+    PlacedNode &placedNode = nodes.emplace_back(PlacedNode{node});
+    emitter->blockNode(node, blockName, [&placedNode, blockName, writeRows](raw_ostream &rowStream)
+    {
+      LabelMeasuringStream measuringStream(rowStream);
+      writeRows(measuringStream);
+      // The block name is the top row of the record.
+      placedNode.measure(std::max(blockName.size(), measuringStream.longestLine()), measuringStream.lineCount() + 1);
+    }, isReturn);
+  }
+
+  void edge(const GraphNode &from, const GraphNode &to, EdgeKind kind) override
+  {
+    emitter->edge(from, to, kind);
+  }
+
+  void heat(double heat) override { emitter->heat(heat); }
+
+private:
+  struct PlacedNode
+  {
+    GraphNode node;
+    double width = minimumWidth;
+    double height = minimumHeight;
+    double x = 0;
+    double y = 0;
+
+    void measure(size_t longestLine, unsigned int lineCount)
+    {
+      width = std::max(minimumWidth, longestLine * characterWidth + labelMargin);
+      height = std::max(minimumHeight, lineCount * lineHeight + labelMargin);
+    }
+  };
+
+  // A block in the layout, indexed by its number minus 100. Only the edges
+  // that go forward in reverse post-order are kept.
+  struct BlockBox
+  {
+    unsigned int rank = 0;
+    double order = 0;
+    SmallVector<unsigned int, 2> predecessors;
+    SmallVector<unsigned int, 2> successors;
+
+    double width = minimumWidth;
+    double height = 0;
+    double summaryWidth = 0;
+    double left = 0;
+    double top = 0;
+  };
+
+  std::unique_ptr<GraphEmitter> emitter;
+  std::vector<BlockBox> blocks;
+  std::vector<std::vector<unsigned int>> ranks;
+  unsigned int entryBlock = 0;
+
+  // Every node in emission order, placed in placeNodes.
+  std::vector<PlacedNode> nodes;
+
+  BlockBox *blockOf(unsigned int blockNumber)
+  {
+    return blockNumber >= 100 && blockNumber - 100 < blocks.size() ? &blocks[blockNumber - 100] : nullptr;
+  }
+
+  void orderRank(std::vector<unsigned int> &rank, bool downwards);
+  void placeNodes();
+};
+
+
+
+LayoutEmitter::LayoutEmitter(const Function &F, const GraphMetadata &metaData, std::unique_ptr<GraphEmitter> emitter)
+  : emitter(std::move(emitter))
+{
+  blocks.resize(F.size());
+  nodes.reserve(F.getInstructionCount() + F.size() + 2);
+
+  // Position of every block in reverse post-order, unreachable blocks follow
+  // in function order.
+  std::vector<unsigned int> traversalOrder;
+  traversalOrder.reserve(F.size());
+  std::vector<unsigned int> traversalIndex(F.size(), ~0u);
+
+  auto visit = [&](const BasicBlock *BB)
+  {
+    unsigned int block = metaData.basicBlockToNumber.lookup(BB) - 100;
+    if (traversalIndex[block] == ~0u)
+    {
+      traversalIndex[block] = traversalOrder.size();
+      traversalOrder.push_back(block);
+    }
+  };
+
+  if (!F.empty())
+  {
+    entryBlock = metaData.basicBlockToNumber.lookup(&F.front()) - 100;
+    for (const BasicBlock *BB : ReversePostOrderTraversal<const Function*>(&F))
+    {
+      visit(BB);
+    }
+  }
+  for (const BasicBlock &BB : F)
+  {
+    visit(&BB);
+  }
+
+  for (const BasicBlock &BB : F)
+  {
+    unsigned int block = metaData.basicBlockToNumber.lookup(&BB) - 100;
+    for (const BasicBlock *successorBlock : successors(&BB))
+    {
+      unsigned int successor = metaData.basicBlockToNumber.lookup(successorBlock) - 100;
+      if (traversalIndex[successor] > traversalIndex[block])
+      {
+        blocks[block].successors.push_back(successor);
+        blocks[successor].predecessors.push_back(block);
+      }
+    }
+  }
+
+  // Longest path layering, every predecessor is ranked before its successors.
+  for (unsigned int block : traversalOrder)
+  {
+    for (unsigned int predecessor : blocks[block].predecessors)
+    {
+      blocks[block].rank = std::max(blocks[block].rank, blocks[predecessor].rank + 1);
+    }
+    if (blocks[block].rank >= ranks.size())
+    {
+      ranks.resize(blocks[block].rank + 1);
+    }
+    blocks[block].order = ranks[blocks[block].rank].size();
+    ranks[blocks[block].rank].push_back(block);
+  }
+
+  for (unsigned int sweep = 0; sweep < orderingSweeps; ++sweep)
+  {
+    for (size_t rank = 1; rank < ranks.size(); ++rank)
+    {
+      orderRank(ranks[rank], true);
+    }
+    for (size_t rank = ranks.size(); rank-- > 1;)
+    {
+      orderRank(ranks[rank - 1], false);
+    }
+  }
+}
+
+
+
+// Sorts a rank by the mean order of the blocks' predecessors, or successors,
+// which pulls connected blocks above each other and untangles the edges.
+// Blocks without any keep their order.
+void LayoutEmitter::orderRank(std::vector<unsigned int> &rank, bool downwards)
+{
+  SmallVector<std::pair<double, unsigned int>, 16> barycenters;
+  barycenters.reserve(rank.size());
+
+  for (unsigned int block : rank)
+  {
+    const SmallVector<unsigned int, 2> &neighbours = downwards ? blocks[block].predecessors : blocks[block].successors;
+
+    double barycenter = blocks[block].order;
+    if (!neighbours.empty())
+    {
+      barycenter = 0;
+      for (unsigned int neighbour : neighbours)
+      {
+        barycenter += blocks[neighbour].order;
+      }
+      barycenter /= neighbours.size();
+    }
+    barycenters.push_back({barycenter, block});
+  }
+
+  // Ties keep their order. Sorted in place, std::stable_sort would allocate
+  // a buffer per rank and sweep.
+  llvm::sort(barycenters, [this](const auto &left, const auto &right)
+  {
+    if (left.first != right.first)
+    {
+      return left.first < right.first;
+    }
+    return blocks[left.second].order < blocks[right.second].order;
+  });
+
+  for (size_t i = 0; i < rank.size(); ++i)
+  {
+    rank[i] = barycenters[i].second;
+    blocks[rank[i]].order = i;
+  }
+}
+
+
+
+void LayoutEmitter::placeNodes()
+{
+  // Sizes of the blocks. Instructions are stacked inside their block, their
+  // y is relative to its top until the blocks are placed.
+  DenseMap<std::pair<unsigned int, unsigned int>, double> instructionRows;
+  instructionRows.reserve(nodes.size());
+
+  for (PlacedNode &placedNode : nodes)
+  {
+    GraphNode node = placedNode.node;
+    BlockBox *block = blockOf(node.first);
+
+    if ((node.kind == NodeKind::Instruction || node.kind == NodeKind::Block) && block)
+    {
+      placedNode.y = block->height + placedNode.height / 2;
+      block->height += placedNode.height + nodeGap;
+      block->width = std::max(block->width, placedNode.width);
+
+      if (node.kind == NodeKind::Instruction)
+      {
+        instructionRows[{node.first, node.second}] = placedNode.y;
+      }
+    }
+    else if (node.kind == NodeKind::UseSummary && block)
+    {
+      block->summaryWidth = std::max(block->summaryWidth, placedNode.width);
+    }
+  }
+
+  // The function name and the arguments head the graph.
+  double headerHeight = 0;
+  for (PlacedNode &placedNode : nodes)
+  {
+    if (placedNode.node.kind == NodeKind::FunctionName || placedNode.node.kind == NodeKind::Arguments)
+    {
+      placedNode.y = headerHeight + placedNode.height / 2;
+      headerHeight += placedNode.height + rankGap;
+    }
+  }
+
+  // Ranks top-down, the blocks of a rank side by side and centered.
+  std::vector<double> rankWidths;
+  double graphWidth = 0;
+  double top = headerHeight;
+
+  for (std::vector<unsigned int> &rank : ranks)
+  {
+    double left = 0;
+    double rankHeight = 0;
+    for (unsigned int block : rank)
+    {
+      BlockBox &box = blocks[block];
+      box.left = left;
+      box.top = top;
+      left += box.width + (box.summaryWidth != 0 ? box.summaryWidth + nodeGap : 0) + columnGap;
+      rankHeight = std::max(rankHeight, box.height);
+    }
+    rankWidths.push_back(left);
+    graphWidth = std::max(graphWidth, left);
+    top += rankHeight + rankGap;
+  }
+
+  for (size_t rank = 0; rank < ranks.size(); ++rank)
+  {
+    for (unsigned int block : ranks[rank])
+    {
+      blocks[block].left += (graphWidth - rankWidths[rank]) / 2;
+    }
+  }
+
+  double sourceColumnWidth = 0;
+  for (const PlacedNode &placedNode : nodes)
+  {
+    if (placedNode.node.kind == NodeKind::SourceLine)
+    {
+      sourceColumnWidth = std::max(sourceColumnWidth, placedNode.width);
+    }
+  }
+
+  double entryCenter = blocks.empty() ? 0 : blocks[entryBlock].left + blocks[entryBlock].width / 2;
+  double argumentsRight = entryCenter;
+  double argumentSummaryLeft = 0;
+  double sourceLineTop = 0;
+  double graphHeight = top;
+
+  for (PlacedNode &placedNode : nodes)
+  {
+    GraphNode node = placedNode.node;
+    BlockBox *block = blockOf(node.first);
+
+    switch (node.kind)
+    {
+      case NodeKind::FunctionName:
+      case NodeKind::Arguments:
+        placedNode.x = entryCenter;
+        argumentsRight = std::max(argumentsRight, entryCenter + placedNode.width / 2);
+        break;
+      case NodeKind::Instruction:
+      case NodeKind::Block:
+        if (block)
+        {
+          placedNode.x = block->left + block->width / 2;
+          placedNode.y += block->top;
+        }
+        break;
+      case NodeKind::UseSummary:
+        if (block)
+        {
+          // Next to the instruction whose users it stands for, or its row
+          // of the block record, below the block name.
+          auto row = instructionRows.find({node.first, node.second});
+          placedNode.x = block->left + block->width + nodeGap + placedNode.width / 2;
+          placedNode.y = block->top + (row != instructionRows.end() ? row->second : labelMargin / 2 + (node.second + 1.5) * lineHeight);
+        }
+        break;
+      case NodeKind::ArgumentUseSummary:
+        placedNode.x = argumentsRight + nodeGap + argumentSummaryLeft + placedNode.width / 2;
+        placedNode.y = headerHeight - rankGap - minimumHeight / 2;
+        argumentSummaryLeft += placedNode.width + nodeGap;
+        break;
+      case NodeKind::SourceLine:
+        // A column of its own right of the graph, in line order.
+        placedNode.x = graphWidth + columnGap + sourceColumnWidth / 2;
+        placedNode.y = sourceLineTop + placedNode.height / 2;
+        sourceLineTop += placedNode.height + nodeGap;
+        break;
+      case NodeKind::PageStub:
+        // Pages are not laid out.
+        break;
+    }
+
+    graphHeight = std::max(graphHeight, placedNode.y + placedNode.height / 2);
+  }
+
+  // Graphviz' y axis points upwards.
+  for (const PlacedNode &placedNode : nodes)
+  {
+    emitter->position(placedNode.node, placedNode.x, graphHeight - placedNode.y);
+  }
+}
+
+
+
+bool ssa2dot::isLayoutEnabled()
+{
+  return layoutEnabled;
+}
+
+
+
+std::unique_ptr<ssa2dot::GraphEmitter> ssa2dot::createLayoutEmitter(const Function &F, const GraphMetadata &metaData, std::unique_ptr<GraphEmitter> emitter)
+{
+  return std::make_unique<LayoutEmitter>(F, metaData, std::move(emitter));
+}
@@ -0,0 +1,93 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotPages.cpp - Pages of oversized function graphs -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Graphviz needs superlinear time and memory in the size of a graph, so a
+// function with many thousand instructions gives a graph no renderer draws
+// in reasonable time. With -ssa2dot-page-size, such a function is split into
+// pages of whole basic blocks in layout order, each with at most the given
+// number of instructions unless a single block is larger. Every page is a
+// graph of its own:
+//
+//   - The first page has the function's arguments and entry edge, every page
+//     has the function name with its page number.
+//   - Branch edges to a block on another page end at a stub node naming the
+//     page and the block.
+//   - Def-use and source edges only connect nodes of the page.
+//
+// Pages are rendered independently, the tool renders them in parallel with
+// -j. Module graphs are not paginated.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned> pageSize("ssa2dot-page-size",
+    cl::desc("Split functions with more instructions into pages of whole blocks, one graph each (0 never splits)"),
+    cl::init(0));
+
+
+
+unsigned int ssa2dot::pageSizeLimit()
+{
+  return pageSize;
+}
+
+
+
+// Blocks are numbered from 100 in layout order, as by
+// mapInstructionToNodeIdentifier.
+std::vector<unsigned int> ssa2dot::paginateFunction(const Function &F)
+{
+  std::vector<unsigned int> pageStarts;
+  if (pageSize == 0 || F.getInstructionCount() <= pageSize)
+  {
+    return pageStarts;
+  }
+
+  unsigned int basicBlockNumber = 100;
+  size_t pageInstructions = 0;
+  for (const BasicBlock &BB : F)
+  {
+    size_t blockInstructions = BB.size();
+    if (pageStarts.empty() || (pageInstructions != 0 && pageInstructions + blockInstructions > pageSize))
+    {
+      pageStarts.push_back(basicBlockNumber);
+      pageInstructions = 0;
+    }
+    pageInstructions += blockInstructions;
+    basicBlockNumber++;
+  }
+
+  // A single block larger than a page leaves nothing to split.
+  if (pageStarts.size() == 1)
+  {
+    pageStarts.clear();
+  }
+
+  return pageStarts;
+}
+
+
+
+// <source>_<function>.page<n>.dot for <source>_<function>.dot, the extension
+// is kept.
+std::string ssa2dot::pageFileName(StringRef fileName, unsigned int pageNumber)
+{
+  StringRef extension = graphFileExtension();
+  StringRef stem = fileName.endswith(extension) ? fileName.drop_back(extension.size()) : fileName;
+  StringRef suffix = fileName.drop_front(stem.size());
+
+  return (stem + ".page" + Twine(pageNumber + 1) + suffix).str();
+}
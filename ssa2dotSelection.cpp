@@ -0,0 +1,210 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotSelection.cpp - Choose the functions to render -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Decides which functions of a module get a graph. Functions are first
+// matched by name, then narrowed down with the data the module carries, so
+// that dumps of whole applications stay within a fixed output budget:
+//
+//   -ssa2dot-min-instructions  drops functions below a size threshold,
+//   -ssa2dot-hottest           keeps the functions with the highest PGO entry
+//                              counts,
+//   -ssa2dot-sample            keeps a reservoir sample of what is left, drawn
+//                              with a fixed seed so every run picks the same.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "ssa2dot"
+
+STATISTIC(NumFunctionsSkipped, "Number of function definitions not selected for rendering");
+
+static cl::list<std::string> functionFilter("ssa2dot-filter",
+    cl::desc("Only render functions whose name or demangled name matches one of these globs"),
+    cl::CommaSeparated);
+
+static cl::opt<unsigned> minInstructions("ssa2dot-min-instructions",
+    cl::desc("Only render functions with at least this many instructions"),
+    cl::init(0));
+
+static cl::opt<unsigned> hottestFunctions("ssa2dot-hottest",
+    cl::desc("Only render the N functions with the highest profile entry counts, 0 renders all"),
+    cl::init(0));
+
+static cl::opt<unsigned> sampleSize("ssa2dot-sample",
+    cl::desc("Only render a deterministic random sample of K functions, 0 renders all"),
+    cl::init(0));
+
+static cl::opt<uint64_t> sampleSeed("ssa2dot-sample-seed",
+    cl::desc("Seed of -ssa2dot-sample"),
+    cl::init(0));
+
+bool hasDebugInfo(const Function &F);
+
+
+
+// True if no -ssa2dot-filter is given or F's name matches one of its globs.
+// The demangled name is only computed when the mangled one does not match.
+bool ssa2dot::isFunctionSelected(const Function &F)
+{
+  // The patterns are compiled once, on first use.
+  static const std::vector<GlobPattern> patterns = []()
+  {
+    std::vector<GlobPattern> compiledPatterns;
+    for (const std::string &pattern : functionFilter)
+    {
+      Expected<GlobPattern> compiledPattern = GlobPattern::create(pattern);
+      if (!compiledPattern)
+      {
+        errs() << "Ignoring invalid -ssa2dot-filter pattern " << pattern << ": " << toString(compiledPattern.takeError()) << "\n";
+        continue;
+      }
+      compiledPatterns.push_back(std::move(*compiledPattern));
+    }
+    return compiledPatterns;
+  }();
+
+  if (functionFilter.empty())
+  {
+    return true;
+  }
+
+  StringRef name = F.getName();
+  for (const GlobPattern &pattern : patterns)
+  {
+    if (pattern.match(name))
+    {
+      return true;
+    }
+  }
+
+  std::string demangledName = demangle(name.str());
+  if (demangledName == name)
+  {
+    return false;
+  }
+
+  for (const GlobPattern &pattern : patterns)
+  {
+    if (pattern.match(demangledName))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+
+// Applies -ssa2dot-filter, the debug info check and then, in this order, the
+// size threshold, the entry count ranking and the sample.
+DenseSet<const Function*> ssa2dot::selectFunctions(const Module &M)
+{
+  std::vector<const Function*> candidates;
+  unsigned int definitionCount = 0;
+
+  for (const Function &F : M.functions())
+  {
+    // Unmaterialized functions are counted too, they are skipped by the filter
+    // before their bodies are read.
+    if (!F.isDeclaration() || F.isMaterializable())
+    {
+      definitionCount++;
+    }
+
+    if (F.isDeclaration() || !isFunctionSelected(F) || !hasDebugInfo(F))
+    {
+      continue;
+    }
+
+    if (F.getInstructionCount() < minInstructions)
+    {
+      continue;
+    }
+
+    candidates.push_back(&F);
+  }
+
+  if (hottestFunctions != 0 && candidates.size() > hottestFunctions)
+  {
+    // Functions without profile data rank below all others, ties keep the
+    // module order.
+    auto entryCount = [](const Function *F) -> uint64_t
+    {
+      if (auto count = F->getEntryCount())
+      {
+        return count->getCount();
+      }
+      return 0;
+    };
+
+    std::vector<const Function*> ranking(candidates);
+    std::stable_sort(ranking.begin(), ranking.end(), [&entryCount](const Function *a, const Function *b)
+    {
+      return entryCount(a) > entryCount(b);
+    });
+    ranking.resize(hottestFunctions);
+
+    DenseSet<const Function*> hottest(ranking.begin(), ranking.end());
+    llvm::erase_if(candidates, [&hottest](const Function *F)
+    {
+      return !hottest.contains(F);
+    });
+  }
+
+  if (sampleSize != 0 && candidates.size() > sampleSize)
+  {
+    // Reservoir sampling over the module order. mt19937_64 produces the same
+    // sequence on every platform, the modulo keeps it free of the library's
+    // distributions, which do not.
+    std::mt19937_64 random(sampleSeed);
+
+    std::vector<const Function*> reservoir(candidates.begin(), candidates.begin() + sampleSize);
+    for (size_t i = sampleSize; i < candidates.size(); ++i)
+    {
+      size_t slot = random() % (i + 1);
+      if (slot < sampleSize)
+      {
+        reservoir[slot] = candidates[i];
+      }
+    }
+
+    candidates = std::move(reservoir);
+  }
+
+  NumFunctionsSkipped += definitionCount - candidates.size();
+  return DenseSet<const Function*>(candidates.begin(), candidates.end());
+}
+
+
+
+StringSet<> ssa2dot::selectFunctionNames(const Module &M)
+{
+  StringSet<> names;
+  for (const Function *F : selectFunctions(M))
+  {
+    names.insert(F->getName());
+  }
+  return names;
+}
@@ -0,0 +1,110 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotSource.cpp - Line index of the source files ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The C cluster shows the source lines the instructions come from. Each source
+// file is mapped into memory once per module and indexed by the offsets of its
+// lines, the index is then shared by every function, and every thread, that
+// refers to the file. Lines are never copied out of the mapping.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+#include <mutex>
+
+using namespace llvm;
+
+
+
+ssa2dot::SourceLineIndex::SourceLineIndex(std::unique_ptr<MemoryBuffer> sourceBuffer)
+  : sourceBuffer(std::move(sourceBuffer))
+{
+  const char *bufferStart = this->sourceBuffer->getBufferStart();
+  const char *bufferEnd = this->sourceBuffer->getBufferEnd();
+
+  lineOffsets.push_back(0);
+  for (const char *lineEnd = bufferStart; (lineEnd = static_cast<const char*>(memchr(lineEnd, '\n', bufferEnd - lineEnd)));)
+  {
+    ++lineEnd;
+    lineOffsets.push_back(lineEnd - bufferStart);
+  }
+
+  // A final newline does not start another line.
+  if (lineOffsets.size() > 1 && lineOffsets.back() == this->sourceBuffer->getBufferSize())
+  {
+    lineOffsets.pop_back();
+  }
+}
+
+
+
+ssa2dot::SourceLineIndex::~SourceLineIndex() = default;
+
+
+
+unsigned int ssa2dot::SourceLineIndex::lineCount() const
+{
+  return lineOffsets.size();
+}
+
+
+
+// Text of a line, counted from 1, without its line break. Out of range lines
+// are empty.
+StringRef ssa2dot::SourceLineIndex::line(unsigned int lineNumber) const
+{
+  if (lineNumber == 0 || lineNumber > lineOffsets.size())
+  {
+    return StringRef();
+  }
+
+  StringRef buffer = sourceBuffer->getBuffer();
+  size_t lineStart = lineOffsets[lineNumber - 1];
+  size_t lineEnd = lineNumber < lineOffsets.size() ? lineOffsets[lineNumber] : buffer.size();
+
+  return buffer.slice(lineStart, lineEnd).rtrim("\r\n");
+}
+
+
+
+std::shared_ptr<const ssa2dot::SourceLineIndex> ssa2dot::SourceLineIndex::create(StringRef fileName)
+{
+  // Not null terminated and not volatile, so that large files get mapped
+  // instead of read.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> sourceBuffer = MemoryBuffer::getFile(fileName, false, false);
+  if (!sourceBuffer)
+  {
+    errs() << "Could not read the source file " << fileName << ": " << sourceBuffer.getError().message() << "\n";
+    return nullptr;
+  }
+
+  return std::shared_ptr<const SourceLineIndex>(new SourceLineIndex(std::move(*sourceBuffer)));
+}
+
+
+
+// Returns the index of a source file, building it on the first request. Files
+// that cannot be read are reported once and give nullptr from then on.
+std::shared_ptr<const ssa2dot::SourceLineIndex> ssa2dot::SourceIndexCache::get(StringRef fileName)
+{
+  std::lock_guard<std::mutex> lock(indexMutex);
+
+  auto [entry, inserted] = indexedFiles.try_emplace(fileName);
+  if (inserted)
+  {
+    entry->second = SourceLineIndex::create(fileName);
+  }
+  return entry->second;
+}
@@ -0,0 +1,154 @@
+
+// Author Philip Kail
+
+//===-- ssa2dotWriter.cpp - Write graphs in the background ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The function pass renders a graph per function. Instead of opening, writing
+// and closing its file before returning to the pass manager, it hands the
+// rendered graph to a writer thread and goes on with the next function, so
+// the compiler only waits for the file system when the queue is full.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/ssa2dot.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "ssa2dot"
+
+STATISTIC(NumFailedWrites, "Number of graphs that could not be written");
+
+static cl::opt<unsigned> writeQueue("ssa2dot-write-queue",
+    cl::desc("Graphs of the function pass waiting to be written in the background, 0 writes them synchronously (default 8)"),
+    cl::init(8));
+
+
+
+unsigned int ssa2dot::writeQueueLimit()
+{
+  return writeQueue;
+}
+
+
+
+ssa2dot::AsyncGraphWriter::AsyncGraphWriter(unsigned int queueLimit)
+  : queueLimit(std::max(queueLimit, 1u)), writerThread(&AsyncGraphWriter::writeQueuedGraphs, this)
+{
+}
+
+
+
+ssa2dot::AsyncGraphWriter::~AsyncGraphWriter()
+{
+  if (Error flushError = flush())
+  {
+    logAllUnhandledErrors(std::move(flushError), errs(), "ssa2dot: ");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopping = true;
+  }
+  queueChanged.notify_all();
+
+  writerThread.join();
+}
+
+
+
+void ssa2dot::AsyncGraphWriter::write(std::string fileName, std::string graph, const MD5::MD5Result &contentHash)
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  queueChanged.wait(lock, [this]()
+  {
+    return queue.size() < queueLimit;
+  });
+
+  queue.push_back({std::move(fileName), std::move(graph), contentHash});
+  lock.unlock();
+
+  queueChanged.notify_all();
+}
+
+
+
+Error ssa2dot::AsyncGraphWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  queueChanged.wait(lock, [this]()
+  {
+    return queue.empty() && !writing;
+  });
+
+  if (failedFiles.empty())
+  {
+    return Error::success();
+  }
+
+  std::string message;
+  raw_string_ostream messageStream(message);
+  messageStream << failedFiles.size() << " graph(s) could not be written:";
+  for (const std::string &fileName : failedFiles)
+  {
+    messageStream << " " << fileName;
+  }
+  failedFiles.clear();
+
+  return createStringError(inconvertibleErrorCode(), messageStream.str());
+}
+
+
+
+// Body of the writer thread. The graph being written is no longer queued,
+// writing keeps flush waiting until its file is complete.
+void ssa2dot::AsyncGraphWriter::writeQueuedGraphs()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+
+  while (true)
+  {
+    queueChanged.wait(lock, [this]()
+    {
+      return !queue.empty() || stopping;
+    });
+
+    if (queue.empty())
+    {
+      return;
+    }
+
+    PendingGraph pendingGraph = std::move(queue.front());
+    queue.pop_front();
+    writing = true;
+    lock.unlock();
+
+    // There is room in the queue again.
+    queueChanged.notify_all();
+
+    bool written = writeGraphFile(pendingGraph.fileName, pendingGraph.graph);
+    if (written)
+    {
+      recordGraph(pendingGraph.fileName, pendingGraph.contentHash);
+    }
+
+    lock.lock();
+    writing = false;
+    if (!written)
+    {
+      NumFailedWrites++;
+      failedFiles.push_back(std::move(pendingGraph.fileName));
+    }
+    queueChanged.notify_all();
+  }
+}